@@ -0,0 +1,227 @@
+/*
+ * Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Asynchronous flushes for unlock.
+ *
+ * Backends whose flush queues device work (a transfer to the host, a copy engine blit)
+ * implement bo_flush_async and hand back a sync_file for that work. For backends whose flush
+ * is CPU work (clflush, copying a shadow buffer back), the flush runs on a worker thread and
+ * the returned fence is a point on a sw_sync timeline that the worker signals when done.
+ *
+ * sw_sync lives in debugfs, or at /dev/sw_sync on older Android kernels. Production Android
+ * and Chrome OS images usually have neither, and then the CPU-side flush runs synchronously
+ * and no fence is returned; this is logged once. Backends with bo_flush_async are unaffected.
+ *
+ * Any later CPU access to a buffer first waits for its queued flushes, so callers that ignore
+ * the fence still see the usual ordering. Buffers count their queued flushes, so the wait
+ * only takes the queue lock while a flush of that buffer is outstanding.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/types.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "drv_priv.h"
+#include "helpers.h"
+#include "stats.h"
+#include "trace.h"
+#include "util.h"
+
+/* Not part of the kernel uapi headers, see drivers/dma-buf/sw_sync.c. */
+struct sw_sync_create_fence_data {
+	__u32 value;
+	char name[32];
+	__s32 fence;
+};
+
+#define SW_SYNC_IOC_MAGIC 'W'
+#define SW_SYNC_IOC_CREATE_FENCE _IOWR(SW_SYNC_IOC_MAGIC, 0, struct sw_sync_create_fence_data)
+#define SW_SYNC_IOC_INC _IOW(SW_SYNC_IOC_MAGIC, 1, __u32)
+
+static const char *const sw_sync_paths[] = { "/sys/kernel/debug/sync/sw_sync", "/dev/sw_sync" };
+
+struct drv_async_job {
+	struct bo *bo;
+	struct mapping *mapping;
+	struct drv_async_job *next;
+};
+
+static pthread_once_t drv_async_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t drv_async_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t drv_async_queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t drv_async_done = PTHREAD_COND_INITIALIZER;
+static struct drv_async_job *drv_async_head, *drv_async_tail;
+/* Published once by drv_async_init_once() after the worker started, read atomically. */
+static int drv_async_timeline = -1;
+/* Timeline value the most recently queued job signals. */
+static uint32_t drv_async_seqno;
+
+static void *drv_async_worker(void *arg)
+{
+	int timeline = (int)(intptr_t)arg;
+	struct drv_async_job *job;
+	__u32 one = 1;
+	int ret;
+
+	pthread_mutex_lock(&drv_async_lock);
+	for (;;) {
+		while (!drv_async_head)
+			pthread_cond_wait(&drv_async_queued, &drv_async_lock);
+
+		job = drv_async_head;
+		drv_async_head = job->next;
+		if (!drv_async_head)
+			drv_async_tail = NULL;
+		pthread_mutex_unlock(&drv_async_lock);
+
+		DRV_TRACE_BEGIN("drv_async_flush handle=%u", job->mapping->vma->handle);
+		ret = drv_bo_flush(job->bo, job->mapping);
+		DRV_TRACE_END();
+		if (ret)
+			drv_log("Async flush failed: %d\n", ret);
+
+		/* Jobs complete in order, so each one advances the timeline by one. */
+		if (ioctl(timeline, SW_SYNC_IOC_INC, &one))
+			drv_log("SW_SYNC_IOC_INC failed: %s\n", strerror(errno));
+
+		pthread_mutex_lock(&drv_async_lock);
+		/* Release, so that a waiter seeing zero without the lock also sees the flush. */
+		__atomic_sub_fetch(&job->bo->async_pending, 1, __ATOMIC_RELEASE);
+		pthread_cond_broadcast(&drv_async_done);
+		free(job);
+	}
+
+	return NULL;
+}
+
+static void drv_async_init_once(void)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+	size_t i;
+	int fd = -1;
+
+	for (i = 0; i < ARRAY_SIZE(sw_sync_paths) && fd < 0; i++)
+		fd = open(sw_sync_paths[i], O_RDWR | O_CLOEXEC);
+
+	if (fd < 0) {
+		drv_log("No sw_sync timeline, flushes on unlock are synchronous\n");
+		return;
+	}
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&thread, &attr, drv_async_worker, (void *)(intptr_t)fd)) {
+		drv_log("Failed to start the async flush thread\n");
+		close(fd);
+	} else {
+		__atomic_store_n(&drv_async_timeline, fd, __ATOMIC_RELEASE);
+	}
+	pthread_attr_destroy(&attr);
+}
+
+void drv_async_wait(struct bo *bo)
+{
+	/* Nothing queued for this buffer, which is the common case: skip the lock. */
+	if (!__atomic_load_n(&bo->async_pending, __ATOMIC_ACQUIRE))
+		return;
+
+	pthread_mutex_lock(&drv_async_lock);
+	while (__atomic_load_n(&bo->async_pending, __ATOMIC_RELAXED))
+		pthread_cond_wait(&drv_async_done, &drv_async_lock);
+	pthread_mutex_unlock(&drv_async_lock);
+}
+
+/* Queues a CPU-side flush. Returns -ENOTSUP when it has to be done synchronously instead. */
+static int drv_async_queue_flush(struct bo *bo, struct mapping *mapping, int *release_fence)
+{
+	struct sw_sync_create_fence_data data;
+	struct drv_async_job *job;
+	int timeline;
+
+	pthread_once(&drv_async_once, drv_async_init_once);
+	timeline = __atomic_load_n(&drv_async_timeline, __ATOMIC_ACQUIRE);
+	if (timeline < 0)
+		return -ENOTSUP;
+
+	job = calloc(1, sizeof(*job));
+	if (!job)
+		return -ENOMEM;
+
+	job->bo = bo;
+	job->mapping = mapping;
+
+	pthread_mutex_lock(&drv_async_lock);
+
+	memset(&data, 0, sizeof(data));
+	data.value = drv_async_seqno + 1;
+	snprintf(data.name, sizeof(data.name), "minigbm-flush-%u", data.value);
+	if (ioctl(timeline, SW_SYNC_IOC_CREATE_FENCE, &data)) {
+		pthread_mutex_unlock(&drv_async_lock);
+		drv_log("SW_SYNC_IOC_CREATE_FENCE failed: %s\n", strerror(errno));
+		free(job);
+		return -ENOTSUP;
+	}
+
+	drv_async_seqno = data.value;
+	__atomic_add_fetch(&bo->async_pending, 1, __ATOMIC_RELAXED);
+	if (drv_async_tail)
+		drv_async_tail->next = job;
+	else
+		drv_async_head = job;
+	drv_async_tail = job;
+
+	pthread_cond_signal(&drv_async_queued);
+	pthread_mutex_unlock(&drv_async_lock);
+
+	*release_fence = data.fence;
+	return 0;
+}
+
+int drv_bo_flush_async(struct bo *bo, struct mapping *mapping, int *release_fence)
+{
+	int ret;
+
+	*release_fence = -1;
+
+	if (bo->drv->backend->bo_flush_async) {
+		uint64_t start;
+
+		drv_async_wait(bo);
+		DRV_TRACE_BEGIN("drv_bo_flush_async handle=%u", mapping->vma->handle);
+		start = drv_stats_begin();
+		ret = bo->drv->backend->bo_flush_async(bo, mapping, release_fence);
+		drv_stats_end(DRV_STAT_BO_FLUSH, start, ret);
+		DRV_TRACE_END();
+		return ret;
+	}
+
+	if (!bo->drv->backend->bo_flush)
+		return 0;
+
+	ret = drv_async_queue_flush(bo, mapping, release_fence);
+	if (ret == -ENOTSUP)
+		ret = drv_bo_flush(bo, mapping);
+
+	return ret;
+}
+
+int drv_bo_flush_or_unmap_async(struct bo *bo, struct mapping *mapping, int *release_fence)
+{
+	if (bo->drv->backend->bo_flush)
+		return drv_bo_flush_async(bo, mapping, release_fence);
+
+	*release_fence = -1;
+	return drv_bo_unmap(bo, mapping);
+}
@@ -0,0 +1,939 @@
+/*
+ * Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Micro-benchmarks for the drv_* API. Every case runs over a matrix of formats, sizes and
+ * thread counts and reports p50/p99 latency and throughput as text, CSV or JSON.
+ *
+ * Runs on any backend minigbm can drive, including vgem and the software backend, so it can
+ * be used in CI without a GPU:
+ *
+ *   make minigbm_bench
+ *   MINIGBM_BACKEND=sw ./minigbm_bench --csv
+ *
+ * Please run clang-format on this file after making changes:
+ *
+ * clang-format -style=file -i minigbm_bench.c
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include <xf86drm.h>
+
+#include "../drv.h"
+#include "../gbm.h"
+#include "../gbm_priv.h"
+#include "../util.h"
+
+#define BENCH_DEFAULT_ITERATIONS 200
+#define BENCH_MAX_THREADS 64
+#define BENCH_RING_DEPTH 3
+#define BENCH_USE_FLAGS (BO_USE_SW_READ_OFTEN | BO_USE_SW_WRITE_OFTEN)
+
+enum bench_output {
+	BENCH_OUTPUT_TEXT,
+	BENCH_OUTPUT_CSV,
+	BENCH_OUTPUT_JSON,
+};
+
+struct bench_format {
+	uint32_t format;
+	const char *name;
+};
+
+struct bench_size {
+	uint32_t width;
+	uint32_t height;
+};
+
+struct bench_thread;
+
+/*
+ * A benchmark case. setup() and teardown() run once per thread outside the timed region,
+ * run() is one timed operation. setup() returns -ENOTSUP when the backend cannot do the
+ * operation for the given configuration, which skips the row instead of failing. Device
+ * cases do not depend on the format or size and run once per thread count.
+ */
+struct bench_case {
+	const char *name;
+	int (*setup)(struct bench_thread *t);
+	int (*run)(struct bench_thread *t);
+	void (*teardown)(struct bench_thread *t);
+	bool device;
+	/* Optional, run once around all threads of a configuration. */
+	void (*begin)(void);
+	void (*end)(void);
+};
+
+struct bench_config {
+	struct driver *drv;
+	const struct bench_case *bench_case;
+	uint32_t format;
+	uint32_t width;
+	uint32_t height;
+	uint64_t use_flags;
+	uint32_t iterations;
+};
+
+struct bench_thread {
+	const struct bench_config *cfg;
+	pthread_t thread;
+	uint64_t *samples;
+	int ret;
+
+	/* Per-case state. */
+	struct bo *bo;
+	struct mapping *mapping;
+	int fds[DRV_MAX_PLANES];
+	struct gbm_device *gbm;
+	struct gbm_surface *surface;
+	struct gbm_bo *front;
+	struct bo *ring[BENCH_RING_DEPTH];
+	int fences[BENCH_RING_DEPTH];
+	uint32_t frame;
+};
+
+struct bench_result {
+	uint64_t p50_ns;
+	uint64_t p99_ns;
+	double ops_per_sec;
+};
+
+static const struct bench_format bench_formats[] = {
+	{ DRM_FORMAT_R8, "R8" },
+	{ DRM_FORMAT_NV12, "NV12" },
+	{ DRM_FORMAT_YVU420_ANDROID, "YVU420_ANDROID" },
+	{ DRM_FORMAT_P010, "P010" },
+	{ DRM_FORMAT_XRGB8888, "XRGB8888" },
+	{ DRM_FORMAT_ABGR16161616F, "ABGR16161616F" },
+};
+
+static const struct bench_size bench_sizes[] = {
+	{ 64, 64 }, { 256, 256 }, { 1280, 720 }, { 1920, 1080 }, { 3840, 2160 }, { 7680, 4320 },
+};
+
+static const uint32_t bench_default_threads[] = { 1, 2, 4, 8 };
+
+static uint64_t bench_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static struct rectangle bench_full_rect(struct bo *bo)
+{
+	struct rectangle rect = { 0, 0, drv_bo_get_width(bo), drv_bo_get_height(bo) };
+	return rect;
+}
+
+static int bench_create_bo(struct bench_thread *t)
+{
+	const struct bench_config *cfg = t->cfg;
+
+	t->bo = drv_bo_create(cfg->drv, cfg->width, cfg->height, cfg->format, cfg->use_flags);
+	return t->bo ? 0 : -ENOMEM;
+}
+
+static void bench_destroy_bo(struct bench_thread *t)
+{
+	if (t->bo)
+		drv_bo_destroy(t->bo);
+	t->bo = NULL;
+}
+
+static int bench_run_create_destroy(struct bench_thread *t)
+{
+	int ret = bench_create_bo(t);
+	if (ret)
+		return ret;
+
+	bench_destroy_bo(t);
+	return 0;
+}
+
+static int bench_setup_create_with_modifiers(struct bench_thread *t)
+{
+	const struct bench_config *cfg = t->cfg;
+	uint64_t modifier = DRM_FORMAT_MOD_LINEAR;
+
+	t->bo = drv_bo_create_with_modifiers(cfg->drv, cfg->width, cfg->height, cfg->format,
+					     &modifier, 1);
+	if (!t->bo)
+		return -ENOTSUP;
+
+	bench_destroy_bo(t);
+	return 0;
+}
+
+static int bench_run_create_with_modifiers(struct bench_thread *t)
+{
+	const struct bench_config *cfg = t->cfg;
+	uint64_t modifier = DRM_FORMAT_MOD_LINEAR;
+
+	t->bo = drv_bo_create_with_modifiers(cfg->drv, cfg->width, cfg->height, cfg->format,
+					     &modifier, 1);
+	if (!t->bo)
+		return -ENOMEM;
+
+	bench_destroy_bo(t);
+	return 0;
+}
+
+static int bench_setup_import(struct bench_thread *t)
+{
+	size_t plane;
+	int ret;
+
+	ret = bench_create_bo(t);
+	if (ret)
+		return ret;
+
+	for (plane = 0; plane < drv_bo_get_num_planes(t->bo); plane++) {
+		t->fds[plane] = drv_bo_get_plane_fd(t->bo, plane);
+		if (t->fds[plane] < 0)
+			return -ENOTSUP;
+	}
+
+	return 0;
+}
+
+static int bench_run_import(struct bench_thread *t)
+{
+	struct drv_import_fd_data data;
+	struct bo *bo;
+	size_t plane;
+
+	memset(&data, 0, sizeof(data));
+	data.width = drv_bo_get_width(t->bo);
+	data.height = drv_bo_get_height(t->bo);
+	data.format = drv_bo_get_format(t->bo);
+	data.use_flags = t->cfg->use_flags;
+	for (plane = 0; plane < drv_bo_get_num_planes(t->bo); plane++) {
+		data.fds[plane] = t->fds[plane];
+		data.strides[plane] = drv_bo_get_plane_stride(t->bo, plane);
+		data.offsets[plane] = drv_bo_get_plane_offset(t->bo, plane);
+		data.format_modifiers[plane] = drv_bo_get_plane_format_modifier(t->bo, plane);
+	}
+
+	bo = drv_bo_import(t->cfg->drv, &data);
+	if (!bo)
+		return -EINVAL;
+
+	drv_bo_destroy(bo);
+	return 0;
+}
+
+static void bench_teardown_import(struct bench_thread *t)
+{
+	size_t plane;
+
+	for (plane = 0; plane < DRV_MAX_PLANES; plane++)
+		if (t->fds[plane] >= 0)
+			close(t->fds[plane]);
+
+	bench_destroy_bo(t);
+}
+
+static int bench_run_map_unmap(struct bench_thread *t)
+{
+	struct rectangle rect = bench_full_rect(t->bo);
+	void *addr;
+
+	addr = drv_bo_map(t->bo, &rect, BO_MAP_READ_WRITE, &t->mapping, 0);
+	if (addr == MAP_FAILED)
+		return -EFAULT;
+
+	return drv_bo_unmap(t->bo, t->mapping);
+}
+
+static int bench_setup_invalidate_flush(struct bench_thread *t)
+{
+	struct rectangle rect;
+	void *addr;
+	int ret;
+
+	ret = bench_create_bo(t);
+	if (ret)
+		return ret;
+
+	rect = bench_full_rect(t->bo);
+	addr = drv_bo_map(t->bo, &rect, BO_MAP_READ_WRITE, &t->mapping, 0);
+	if (addr == MAP_FAILED) {
+		t->mapping = NULL;
+		return -ENOTSUP;
+	}
+
+	return 0;
+}
+
+static int bench_run_invalidate_flush(struct bench_thread *t)
+{
+	int ret = drv_bo_invalidate(t->bo, t->mapping);
+	if (ret)
+		return ret;
+
+	return drv_bo_flush(t->bo, t->mapping);
+}
+
+static void bench_teardown_invalidate_flush(struct bench_thread *t)
+{
+	if (t->mapping)
+		drv_bo_unmap(t->bo, t->mapping);
+
+	bench_destroy_bo(t);
+}
+
+static int bench_run_export_fd(struct bench_thread *t)
+{
+	int fd = drv_bo_get_plane_fd(t->bo, 0);
+	if (fd < 0)
+		return fd;
+
+	close(fd);
+	return 0;
+}
+
+static int bench_setup_surface_flip(struct bench_thread *t)
+{
+	const struct bench_config *cfg = t->cfg;
+
+	t->gbm = gbm_create_device(drv_get_fd(cfg->drv));
+	if (!t->gbm)
+		return -ENODEV;
+
+	t->surface = gbm_surface_create(t->gbm, cfg->width, cfg->height, cfg->format,
+					GBM_BO_USE_SCANOUT | GBM_BO_USE_RENDERING);
+	return t->surface ? 0 : -ENOTSUP;
+}
+
+/* One frame of a page flip loop: render into the back buffer, flip, retire the old front. */
+static int bench_run_surface_flip(struct bench_thread *t)
+{
+	struct gbm_bo *front;
+
+	if (!gbm_surface_get_back_buffer(t->surface))
+		return -ENOMEM;
+
+	front = gbm_surface_lock_front_buffer(t->surface);
+	if (t->front)
+		gbm_surface_release_buffer(t->surface, t->front);
+	t->front = front;
+
+	return 0;
+}
+
+static void bench_teardown_surface_flip(struct bench_thread *t)
+{
+	if (t->surface)
+		gbm_surface_destroy(t->surface);
+	if (t->gbm)
+		gbm_device_destroy(t->gbm);
+}
+
+static int bench_setup_first_touch(struct bench_thread *t)
+{
+	drv_set_map_populate(t->cfg->drv, DRV_MAP_POPULATE_NEVER);
+	return bench_create_bo(t);
+}
+
+static int bench_setup_first_touch_populated(struct bench_thread *t)
+{
+	drv_set_map_populate(t->cfg->drv, DRV_MAP_POPULATE_ALWAYS);
+	return bench_create_bo(t);
+}
+
+/* Maps the buffer and writes one byte per page, as the first lock of a CPU producer does. */
+static int bench_run_first_touch(struct bench_thread *t)
+{
+	struct rectangle rect = bench_full_rect(t->bo);
+	size_t last = drv_bo_get_num_planes(t->bo) - 1;
+	size_t size = drv_bo_get_plane_offset(t->bo, last) + drv_bo_get_plane_size(t->bo, last);
+	size_t page_size = getpagesize();
+	uint8_t *addr;
+	size_t i;
+
+	addr = drv_bo_map(t->bo, &rect, BO_MAP_WRITE, &t->mapping, 0);
+	if (addr == MAP_FAILED)
+		return -EFAULT;
+
+	for (i = 0; i < size; i += page_size)
+		addr[i] = (uint8_t)i;
+
+	return drv_bo_unmap(t->bo, t->mapping);
+}
+
+static void bench_teardown_first_touch(struct bench_thread *t)
+{
+	drv_set_map_populate(t->cfg->drv, DRV_MAP_POPULATE_DEFAULT);
+	bench_destroy_bo(t);
+}
+
+static int bench_setup_produce(struct bench_thread *t)
+{
+	const struct bench_config *cfg = t->cfg;
+	uint32_t i;
+
+	for (i = 0; i < BENCH_RING_DEPTH; i++)
+		t->fences[i] = -1;
+
+	for (i = 0; i < BENCH_RING_DEPTH; i++) {
+		t->ring[i] =
+		    drv_bo_create(cfg->drv, cfg->width, cfg->height, cfg->format, cfg->use_flags);
+		if (!t->ring[i])
+			return -ENOMEM;
+	}
+
+	t->frame = 0;
+	return 0;
+}
+
+static void bench_wait_fence(int *fence)
+{
+	struct pollfd pfd = { *fence, POLLIN, 0 };
+
+	if (*fence < 0)
+		return;
+
+	while (poll(&pfd, 1, -1) < 0 && (errno == EINTR || errno == EAGAIN))
+		;
+
+	close(*fence);
+	*fence = -1;
+}
+
+/*
+ * One frame of a CPU producer cycling through a small ring: wait until the slot's previous
+ * flush has retired, write a row, and hand the buffer back. The pipelined variant returns as
+ * soon as the flush is queued, so it overlaps with writing the next slot.
+ */
+static int bench_produce_frame(struct bench_thread *t, bool pipelined)
+{
+	uint32_t slot = t->frame++ % BENCH_RING_DEPTH;
+	struct bo *bo = t->ring[slot];
+	struct rectangle rect = bench_full_rect(bo);
+	struct mapping *mapping;
+	uint8_t *addr;
+
+	bench_wait_fence(&t->fences[slot]);
+
+	addr = drv_bo_map(bo, &rect, BO_MAP_WRITE, &mapping, 0);
+	if (addr == MAP_FAILED)
+		return -EFAULT;
+
+	memset(addr, slot, drv_bo_get_plane_stride(bo, 0));
+
+	if (pipelined)
+		return drv_bo_flush_or_unmap_async(bo, mapping, &t->fences[slot]);
+
+	return drv_bo_flush_or_unmap(bo, mapping);
+}
+
+static int bench_run_unlock_sync(struct bench_thread *t)
+{
+	return bench_produce_frame(t, false);
+}
+
+static int bench_run_unlock_pipelined(struct bench_thread *t)
+{
+	return bench_produce_frame(t, true);
+}
+
+static void bench_teardown_produce(struct bench_thread *t)
+{
+	uint32_t i;
+
+	for (i = 0; i < BENCH_RING_DEPTH; i++) {
+		bench_wait_fence(&t->fences[i]);
+		if (t->ring[i])
+			drv_bo_destroy(t->ring[i]);
+		t->ring[i] = NULL;
+	}
+}
+
+/* What cros_gralloc_driver::init() does: find the render nodes and bring up the first one. */
+static int bench_init_device(void)
+{
+	struct drv_render_node nodes[DRV_MAX_RENDER_NODES];
+	struct driver *drv;
+	int i, count, ret = 0;
+
+	count = drv_find_render_nodes(nodes, ARRAY_SIZE(nodes));
+	if (count < 0)
+		count = 0;
+
+	drv = drv_create(count ? nodes[0].fd : -1);
+	if (!drv || drv_init(drv, 0))
+		ret = -ENODEV;
+
+	if (drv)
+		drv_destroy(drv);
+
+	for (i = 0; i < count; i++)
+		close(nodes[i].fd);
+
+	return ret;
+}
+
+static const char *const bench_cache_envs[] = { "MINIGBM_PROBE_CACHE", "MINIGBM_CACHE_DIR" };
+static char *bench_saved_cache_envs[ARRAY_SIZE(bench_cache_envs)];
+
+/*
+ * Cold init is init without the caches. Clearing them from every thread at once would
+ * measure races on the cache files instead, so they are cleared once and then bypassed.
+ */
+static void bench_begin_init_cold(void)
+{
+	const char *value;
+	size_t i;
+
+	drv_probe_cache_clear();
+
+	for (i = 0; i < ARRAY_SIZE(bench_cache_envs); i++) {
+		value = getenv(bench_cache_envs[i]);
+		bench_saved_cache_envs[i] = value ? strdup(value) : NULL;
+		setenv(bench_cache_envs[i], "", 1);
+	}
+}
+
+static void bench_end_init_cold(void)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(bench_cache_envs); i++) {
+		if (bench_saved_cache_envs[i])
+			setenv(bench_cache_envs[i], bench_saved_cache_envs[i], 1);
+		else
+			unsetenv(bench_cache_envs[i]);
+
+		free(bench_saved_cache_envs[i]);
+		bench_saved_cache_envs[i] = NULL;
+	}
+}
+
+static int bench_run_init_cold(struct bench_thread *t)
+{
+	return bench_init_device();
+}
+
+static int bench_setup_init_warm(struct bench_thread *t)
+{
+	return bench_init_device();
+}
+
+static int bench_run_init_warm(struct bench_thread *t)
+{
+	return bench_init_device();
+}
+
+static const struct bench_case bench_cases[] = {
+	{ "init_cold", NULL, bench_run_init_cold, NULL, true, bench_begin_init_cold,
+	  bench_end_init_cold },
+	{ "init_warm", bench_setup_init_warm, bench_run_init_warm, NULL, true },
+	{ "create_destroy", NULL, bench_run_create_destroy, NULL },
+	{ "create_with_modifiers", bench_setup_create_with_modifiers,
+	  bench_run_create_with_modifiers, NULL },
+	{ "import", bench_setup_import, bench_run_import, bench_teardown_import },
+	{ "map_unmap", bench_create_bo, bench_run_map_unmap, bench_destroy_bo },
+	{ "invalidate_flush", bench_setup_invalidate_flush, bench_run_invalidate_flush,
+	  bench_teardown_invalidate_flush },
+	{ "export_fd", bench_create_bo, bench_run_export_fd, bench_destroy_bo },
+	{ "surface_flip", bench_setup_surface_flip, bench_run_surface_flip,
+	  bench_teardown_surface_flip },
+	{ "first_touch", bench_setup_first_touch, bench_run_first_touch,
+	  bench_teardown_first_touch },
+	{ "first_touch_populated", bench_setup_first_touch_populated, bench_run_first_touch,
+	  bench_teardown_first_touch },
+	{ "unlock_sync", bench_setup_produce, bench_run_unlock_sync, bench_teardown_produce },
+	{ "unlock_pipelined", bench_setup_produce, bench_run_unlock_pipelined,
+	  bench_teardown_produce },
+};
+
+static void *bench_thread_main(void *arg)
+{
+	struct bench_thread *t = arg;
+	const struct bench_case *c = t->cfg->bench_case;
+	uint64_t start;
+	uint32_t i;
+
+	for (i = 0; i < t->cfg->iterations; i++) {
+		start = bench_now_ns();
+		t->ret = c->run(t);
+		t->samples[i] = bench_now_ns() - start;
+		if (t->ret)
+			break;
+	}
+
+	return NULL;
+}
+
+static int bench_compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static int bench_run_config(const struct bench_config *cfg, uint32_t num_threads,
+			    struct bench_result *result)
+{
+	const struct bench_case *c = cfg->bench_case;
+	struct bench_thread threads[BENCH_MAX_THREADS];
+	uint64_t *samples, start, elapsed;
+	uint32_t i, j, total;
+	int ret = 0;
+
+	total = cfg->iterations * num_threads;
+	samples = calloc(total, sizeof(*samples));
+	if (!samples)
+		return -ENOMEM;
+
+	memset(threads, 0, sizeof(threads));
+	for (i = 0; i < num_threads; i++) {
+		threads[i].cfg = cfg;
+		threads[i].samples = &samples[i * cfg->iterations];
+		for (j = 0; j < DRV_MAX_PLANES; j++)
+			threads[i].fds[j] = -1;
+
+		if (c->setup) {
+			ret = c->setup(&threads[i]);
+			if (ret) {
+				num_threads = i + 1;
+				goto teardown;
+			}
+		}
+	}
+
+	if (c->begin)
+		c->begin();
+
+	start = bench_now_ns();
+	for (i = 0; i < num_threads; i++)
+		pthread_create(&threads[i].thread, NULL, bench_thread_main, &threads[i]);
+
+	for (i = 0; i < num_threads; i++) {
+		pthread_join(threads[i].thread, NULL);
+		if (threads[i].ret)
+			ret = threads[i].ret;
+	}
+	elapsed = bench_now_ns() - start;
+
+	if (c->end)
+		c->end();
+
+	if (!ret) {
+		qsort(samples, total, sizeof(*samples), bench_compare_u64);
+		result->p50_ns = samples[total / 2];
+		result->p99_ns = samples[(uint64_t)total * 99 / 100];
+		result->ops_per_sec = elapsed ? (double)total * 1e9 / elapsed : 0.0;
+	}
+
+teardown:
+	for (i = 0; i < num_threads; i++)
+		if (c->teardown)
+			c->teardown(&threads[i]);
+
+	free(samples);
+	return ret;
+}
+
+static void bench_print_header(enum bench_output output)
+{
+	switch (output) {
+	case BENCH_OUTPUT_TEXT:
+		printf("%-22s %-15s %11s %7s %10s %10s %12s\n", "case", "format", "size",
+		       "threads", "p50(us)", "p99(us)", "ops/s");
+		break;
+	case BENCH_OUTPUT_CSV:
+		printf("backend,case,format,width,height,threads,iterations,p50_ns,p99_ns,"
+		       "ops_per_sec\n");
+		break;
+	case BENCH_OUTPUT_JSON:
+		printf("[\n");
+		break;
+	}
+}
+
+static void bench_print_result(enum bench_output output, const struct bench_config *cfg,
+			       const char *format_name, uint32_t num_threads,
+			       const struct bench_result *result, bool first)
+{
+	char size[32];
+
+	switch (output) {
+	case BENCH_OUTPUT_TEXT:
+		snprintf(size, sizeof(size), "%ux%u", cfg->width, cfg->height);
+		printf("%-22s %-15s %11s %7u %10.2f %10.2f %12.0f\n", cfg->bench_case->name,
+		       format_name, size, num_threads, result->p50_ns / 1000.0,
+		       result->p99_ns / 1000.0, result->ops_per_sec);
+		break;
+	case BENCH_OUTPUT_CSV:
+		printf("%s,%s,%s,%u,%u,%u,%u,%llu,%llu,%.0f\n", drv_get_name(cfg->drv),
+		       cfg->bench_case->name, format_name, cfg->width, cfg->height, num_threads,
+		       cfg->iterations, (unsigned long long)result->p50_ns,
+		       (unsigned long long)result->p99_ns, result->ops_per_sec);
+		break;
+	case BENCH_OUTPUT_JSON:
+		printf("%s  {\"backend\": \"%s\", \"case\": \"%s\", \"format\": \"%s\", "
+		       "\"width\": %u, \"height\": %u, \"threads\": %u, \"iterations\": %u, "
+		       "\"p50_ns\": %llu, \"p99_ns\": %llu, \"ops_per_sec\": %.0f}",
+		       first ? "" : ",\n", drv_get_name(cfg->drv), cfg->bench_case->name,
+		       format_name, cfg->width, cfg->height, num_threads, cfg->iterations,
+		       (unsigned long long)result->p50_ns, (unsigned long long)result->p99_ns,
+		       result->ops_per_sec);
+		break;
+	}
+}
+
+static void bench_print_footer(enum bench_output output)
+{
+	if (output == BENCH_OUTPUT_JSON)
+		printf("\n]\n");
+}
+
+/* Opens device, or else the render node gralloc would use, or else the software backend. */
+static struct driver *bench_open_driver(const char *device)
+{
+	struct drv_render_node nodes[DRV_MAX_RENDER_NODES];
+	struct driver *drv = NULL;
+	int i, count, fd;
+
+	if (device) {
+		fd = open(device, O_RDWR | O_CLOEXEC);
+		if (fd < 0) {
+			fprintf(stderr, "failed to open %s: %s\n", device, strerror(errno));
+			return NULL;
+		}
+
+		drv = drv_create(fd);
+		if (!drv)
+			close(fd);
+	} else {
+		count = drv_find_render_nodes(nodes, ARRAY_SIZE(nodes));
+		for (i = 0; i < count; i++) {
+			if (!drv)
+				drv = drv_create(nodes[i].fd);
+			if (!drv || drv_get_fd(drv) != nodes[i].fd)
+				close(nodes[i].fd);
+		}
+
+		/* No usable DRM device: fall back to the software backend. */
+		if (!drv)
+			drv = drv_create(-1);
+	}
+
+	if (drv && drv_init(drv, 0)) {
+		fprintf(stderr, "failed to init %s\n", drv_get_name(drv));
+		fd = drv_get_fd(drv);
+		drv_destroy(drv);
+		if (fd >= 0)
+			close(fd);
+		return NULL;
+	}
+
+	return drv;
+}
+
+static int bench_parse_threads(const char *arg, uint32_t *threads, uint32_t max)
+{
+	char *copy, *tok, *save = NULL;
+	uint32_t count = 0;
+	long value;
+
+	copy = strdup(arg);
+	if (!copy)
+		return -ENOMEM;
+
+	for (tok = strtok_r(copy, ",", &save); tok && count < max;
+	     tok = strtok_r(NULL, ",", &save)) {
+		value = strtol(tok, NULL, 0);
+		if (value < 1 || value > BENCH_MAX_THREADS) {
+			free(copy);
+			return -EINVAL;
+		}
+		threads[count++] = value;
+	}
+
+	free(copy);
+	return count ? (int)count : -EINVAL;
+}
+
+static void bench_usage(const char *argv0)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -d, --device PATH     DRM node to use (default: first usable render node, then"
+		" the software backend)\n"
+		"  -i, --iterations N    timed iterations per thread (default: %u)\n"
+		"  -t, --threads LIST    comma separated thread counts (default: 1,2,4,8)\n"
+		"  -c, --case NAME       only run cases whose name contains NAME\n"
+		"      --csv             CSV output\n"
+		"      --json            JSON output\n",
+		argv0, BENCH_DEFAULT_ITERATIONS);
+}
+
+int main(int argc, char *argv[])
+{
+	static const struct option long_options[] = {
+		{ "device", required_argument, NULL, 'd' },
+		{ "iterations", required_argument, NULL, 'i' },
+		{ "threads", required_argument, NULL, 't' },
+		{ "case", required_argument, NULL, 'c' },
+		{ "csv", no_argument, NULL, 'C' },
+		{ "json", no_argument, NULL, 'J' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 },
+	};
+	enum bench_output output = BENCH_OUTPUT_TEXT;
+	uint32_t threads[BENCH_MAX_THREADS];
+	uint32_t num_thread_counts = ARRAY_SIZE(bench_default_threads);
+	uint32_t iterations = BENCH_DEFAULT_ITERATIONS;
+	const char *device = NULL, *filter = NULL;
+	char probe_cache[64] = "";
+	struct bench_config cfg;
+	struct bench_result result;
+	struct driver *drv;
+	size_t c, f, s, n;
+	bool first = true;
+	int opt, ret, fd;
+
+	memcpy(threads, bench_default_threads, sizeof(bench_default_threads));
+
+	while ((opt = getopt_long(argc, argv, "d:i:t:c:h", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'd':
+			device = optarg;
+			break;
+		case 'i':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			ret = bench_parse_threads(optarg, threads, ARRAY_SIZE(threads));
+			if (ret < 0) {
+				bench_usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			num_thread_counts = ret;
+			break;
+		case 'c':
+			filter = optarg;
+			break;
+		case 'C':
+			output = BENCH_OUTPUT_CSV;
+			break;
+		case 'J':
+			output = BENCH_OUTPUT_JSON;
+			break;
+		default:
+			bench_usage(argv[0]);
+			return (opt == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (!iterations) {
+		bench_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	/* Keep the init cases away from the cache gralloc uses. */
+	if (!getenv("MINIGBM_PROBE_CACHE")) {
+		snprintf(probe_cache, sizeof(probe_cache), "/tmp/minigbm_bench_probe.%d", getpid());
+		setenv("MINIGBM_PROBE_CACHE", probe_cache, 1);
+	}
+
+	drv = bench_open_driver(device);
+	if (!drv) {
+		fprintf(stderr, "no usable minigbm backend\n");
+		return EXIT_FAILURE;
+	}
+
+	if (output == BENCH_OUTPUT_TEXT)
+		printf("backend: %s\n", drv_get_name(drv));
+
+	bench_print_header(output);
+
+	for (c = 0; c < ARRAY_SIZE(bench_cases); c++) {
+		if (filter && !strstr(bench_cases[c].name, filter))
+			continue;
+
+		if (bench_cases[c].device) {
+			memset(&cfg, 0, sizeof(cfg));
+			cfg.drv = drv;
+			cfg.bench_case = &bench_cases[c];
+			cfg.iterations = iterations;
+
+			for (n = 0; n < num_thread_counts; n++) {
+				ret = bench_run_config(&cfg, threads[n], &result);
+				if (ret) {
+					fprintf(stderr, "%s failed: %s\n", cfg.bench_case->name,
+						strerror(-ret));
+					break;
+				}
+
+				bench_print_result(output, &cfg, "-", threads[n], &result, first);
+				first = false;
+			}
+			continue;
+		}
+
+		for (f = 0; f < ARRAY_SIZE(bench_formats); f++) {
+			memset(&cfg, 0, sizeof(cfg));
+			cfg.drv = drv;
+			cfg.bench_case = &bench_cases[c];
+			cfg.format = bench_formats[f].format;
+			cfg.use_flags = BENCH_USE_FLAGS;
+			cfg.iterations = iterations;
+
+			if (!drv_get_combination(drv, cfg.format, cfg.use_flags))
+				continue;
+
+			for (s = 0; s < ARRAY_SIZE(bench_sizes); s++) {
+				cfg.width = bench_sizes[s].width;
+				cfg.height = bench_sizes[s].height;
+
+				for (n = 0; n < num_thread_counts; n++) {
+					ret = bench_run_config(&cfg, threads[n], &result);
+					if (ret == -ENOTSUP)
+						break;
+					if (ret) {
+						fprintf(stderr, "%s %s %ux%u failed: %s\n",
+							cfg.bench_case->name, bench_formats[f].name,
+							cfg.width, cfg.height, strerror(-ret));
+						break;
+					}
+
+					bench_print_result(output, &cfg, bench_formats[f].name,
+							   threads[n], &result, first);
+					first = false;
+				}
+			}
+		}
+	}
+
+	bench_print_footer(output);
+
+	if (probe_cache[0])
+		unlink(probe_cache);
+
+	fd = drv_get_fd(drv);
+	drv_destroy(drv);
+	if (fd >= 0)
+		close(fd);
+
+	return EXIT_SUCCESS;
+}
@@ -9,7 +9,7 @@
 #include <assert.h>
 #include <sys/mman.h>
 
-cros_gralloc_buffer::cros_gralloc_buffer(uint32_t id, struct bo *acquire_bo,
+cros_gralloc_buffer::cros_gralloc_buffer(uint64_t id, struct bo *acquire_bo,
 					 struct cros_gralloc_handle *acquire_handle,
 					 int32_t reserved_region_fd, uint64_t reserved_region_size)
     : id_(id), bo_(acquire_bo), hnd_(acquire_handle), refcount_(1), lockcount_(0),
@@ -34,7 +34,7 @@ cros_gralloc_buffer::~cros_gralloc_buffer()
 	}
 }
 
-uint32_t cros_gralloc_buffer::get_id() const
+uint64_t cros_gralloc_buffer::get_id() const
 {
 	return id_;
 }
@@ -68,7 +68,7 @@ int32_t cros_gralloc_buffer::lock(const struct rectangle *rect, uint32_t map_fla
 
 	if (map_flags) {
 		if (lock_data_[0]) {
-			drv_bo_invalidate(bo_, lock_data_[0]);
+			drv_bo_invalidate_flags(bo_, lock_data_[0], map_flags);
 			vaddr = lock_data_[0]->vma->addr;
 		} else {
 			struct rectangle r = *rect;
@@ -116,7 +116,7 @@ int32_t cros_gralloc_buffer::lock(uint32_t map_flags, uint8_t *addr[DRV_MAX_PLAN
 
         if (map_flags) {
                 if (lock_data_[0]) {
-                        drv_bo_invalidate(bo_, lock_data_[0]);
+                        drv_bo_invalidate_flags(bo_, lock_data_[0], map_flags);
 			vaddr = lock_data_[0]->vma->addr;
                 } else {
                         struct rectangle r = {0, 0, 0, 0};
@@ -146,8 +146,10 @@ int32_t cros_gralloc_buffer::lock(uint32_t map_flags, uint8_t *addr[DRV_MAX_PLAN
 }
 #endif
 
-int32_t cros_gralloc_buffer::unlock()
+int32_t cros_gralloc_buffer::unlock(int32_t *release_fence)
 {
+	*release_fence = -1;
+
 	if (lockcount_ <= 0) {
 		drv_log("Buffer was not locked.\n");
 		return -EINVAL;
@@ -155,7 +157,7 @@ int32_t cros_gralloc_buffer::unlock()
 
 	if (!--lockcount_) {
 		if (lock_data_[0]) {
-			drv_bo_flush_or_unmap(bo_, lock_data_[0]);
+			drv_bo_flush_or_unmap_async(bo_, lock_data_[0], release_fence);
 			lock_data_[0] = nullptr;
 		}
 	}
@@ -183,15 +185,17 @@ int32_t cros_gralloc_buffer::invalidate()
 	return 0;
 }
 
-int32_t cros_gralloc_buffer::flush()
+int32_t cros_gralloc_buffer::flush(int32_t *release_fence)
 {
+	*release_fence = -1;
+
 	if (lockcount_ <= 0) {
 		drv_log("Buffer was not locked.\n");
 		return -EINVAL;
 	}
 
 	if (lock_data_[0]) {
-		return drv_bo_flush(bo_, lock_data_[0]);
+		return drv_bo_flush_async(bo_, lock_data_[0], release_fence);
 	}
 
 	return 0;
@@ -209,6 +213,7 @@ int32_t cros_gralloc_buffer::get_reserved_region(void **addr, uint64_t *size)
 					     MAP_SHARED, reserved_region_fd_, 0);
 		if (reserved_region_addr_ == MAP_FAILED) {
 			drv_log("Failed to mmap reserved region: %s.\n", strerror(errno));
+			reserved_region_addr_ = nullptr;
 			return -errno;
 		}
 	}
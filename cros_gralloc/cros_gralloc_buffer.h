@@ -13,12 +13,12 @@
 class cros_gralloc_buffer
 {
       public:
-	cros_gralloc_buffer(uint32_t id, struct bo *acquire_bo,
+	cros_gralloc_buffer(uint64_t id, struct bo *acquire_bo,
 			    struct cros_gralloc_handle *acquire_handle, int32_t reserved_region_fd,
 			    uint64_t reserved_region_size);
 	~cros_gralloc_buffer();
 
-	uint32_t get_id() const;
+	uint64_t get_id() const;
 
 	/* The new reference count is returned by both these functions. */
 	int32_t increase_refcount();
@@ -29,11 +29,12 @@ class cros_gralloc_buffer
 #ifdef USE_GRALLOC1
 	int32_t lock(uint32_t map_flags, uint8_t *addr[DRV_MAX_PLANES]);
 #endif
-	int32_t unlock();
+	/* *release_fence signals when the flush of the CPU writes has completed, or is -1. */
+	int32_t unlock(int32_t *release_fence);
 	int32_t resource_info(uint32_t strides[DRV_MAX_PLANES], uint32_t offsets[DRV_MAX_PLANES]);
 
 	int32_t invalidate();
-	int32_t flush();
+	int32_t flush(int32_t *release_fence);
 
 	int32_t get_reserved_region(void **reserved_region_addr, uint64_t *reserved_region_size);
 
@@ -41,7 +42,7 @@ class cros_gralloc_buffer
 	cros_gralloc_buffer(cros_gralloc_buffer const &);
 	cros_gralloc_buffer operator=(cros_gralloc_buffer const &);
 
-	uint32_t id_;
+	uint64_t id_;
 	struct bo *bo_;
 
 	/* Note: this will be nullptr for imported/retained buffers. */
@@ -19,9 +19,23 @@
 #include "i915_private_android.h"
 #endif
 
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS 1033
+#define F_SEAL_SEAL 0x0001
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_GROW 0x0004
+#endif
+
+/* Traces the rest of the scope, tagged with the buffer behind |hnd|. */
+#define CROS_GRALLOC_TRACE_HANDLE(op, hnd)                                                         \
+	CROS_GRALLOC_TRACE(op " id=%u " DRV_TRACE_FOURCC " %ux%u size=%llu usage=0x%x", (hnd)->id, \
+			   DRV_TRACE_FOURCC_ARGS((hnd)->format), (hnd)->width, (hnd)->height,      \
+			   (unsigned long long)(hnd)->total_size, (hnd)->usage)
+
 // drv_kms_ aim to open the display node
 // drv_render_ aim to open the render node
-cros_gralloc_driver::cros_gralloc_driver() : drv_kms_(nullptr), drv_render_(nullptr)
+cros_gralloc_driver::cros_gralloc_driver()
+    : drv_kms_(nullptr), drv_render_(nullptr), kms_fd_(-1), kms_grp_type_(0)
 {
 }
 
@@ -30,24 +44,67 @@ cros_gralloc_driver::~cros_gralloc_driver()
 	buffers_.clear();
 	handles_.clear();
 
-	if (drv_kms_) {
-		int fd = drv_get_fd(drv_kms_);
-		drv_destroy(drv_kms_);
-		if (!is_kmsro_enabled()) {
-			drv_render_ = nullptr;
-		}
-		drv_kms_ = nullptr;
+	destroy_drivers();
+}
+
+void cros_gralloc_driver::destroy_drivers()
+{
+	struct driver *kms = drv_kms_.exchange(nullptr);
+
+	if (kms && kms != drv_render_) {
+		int fd = drv_get_fd(kms);
+		drv_destroy(kms);
 		close(fd);
 	}
 
+	if (kms_fd_ >= 0) {
+		close(kms_fd_);
+		kms_fd_ = -1;
+	}
+
 	if (drv_render_) {
 		int fd = drv_get_fd(drv_render_);
 		drv_destroy(drv_render_);
 		drv_render_ = nullptr;
-		close(fd);
+		if (fd >= 0)
+			close(fd);
 	}
 }
 
+/*
+ * The display driver is only needed for scanout buffers, which most processes never touch, so
+ * it is created on first use. Falls back to the render driver if the display node is unusable.
+ */
+struct driver *cros_gralloc_driver::get_drv_kms()
+{
+	struct driver *drv = drv_kms_.load(std::memory_order_acquire);
+	if (drv)
+		return drv;
+
+	std::lock_guard<std::mutex> lock(kms_mutex_);
+	drv = drv_kms_.load(std::memory_order_relaxed);
+	if (drv)
+		return drv;
+
+	drv = drv_create(kms_fd_);
+	if (drv && drv_init(drv, kms_grp_type_)) {
+		drv_destroy(drv);
+		drv = nullptr;
+	}
+
+	if (drv) {
+		kms_fd_ = -1;
+	} else {
+		drv_log("Failed to create kms driver, using the render driver\n");
+		close(kms_fd_);
+		kms_fd_ = -1;
+		drv = drv_render_;
+	}
+
+	drv_kms_.store(drv, std::memory_order_release);
+	return drv;
+}
+
 int32_t cros_gralloc_driver::init()
 {
 	/*
@@ -57,79 +114,45 @@ int32_t cros_gralloc_driver::init()
 	 * TODO(gsingh): Enable render nodes on udl/evdi.
 	 */
 
-	int fd;
-	drmVersionPtr version;
-	char const *str = "%s/renderD%d";
 	const char *undesired[2] = { "vgem", nullptr };
-	uint32_t num_nodes = 63;
-	uint32_t min_node = 128;
-	uint32_t max_node = (min_node + num_nodes);
 	uint32_t j;
-	char *node;
 
 	const int render_num = 10;
 	int node_fd[render_num];
-	char *node_name[render_num] = {};
+	const char *node_name[render_num] = {};
 	int availabe_node = 0;
 	int virtio_node_idx = -1;
 	uint32_t gpu_grp_type = 0;
+	const char *backend = getenv("MINIGBM_BACKEND");
+	struct drv_render_node nodes[DRV_MAX_RENDER_NODES];
+	int num_nodes = 0;
 
 	// destroy drivers if exist before re-initializing them
-	if (drv_kms_) {
-		int fd = drv_get_fd(drv_kms_);
-		drv_destroy(drv_kms_);
-		if (!is_kmsro_enabled()) {
-			drv_render_ = nullptr;
-		}
-		drv_kms_ = nullptr;
-		close(fd);
-	}
+	destroy_drivers();
 
-	if (drv_render_) {
-		int fd = drv_get_fd(drv_render_);
-		drv_destroy(drv_render_);
-		drv_render_ = nullptr;
-		close(fd);
-	}
-
-	for (uint32_t i = min_node; i < max_node; i++) {
-		if (asprintf(&node, str, DRM_DIR_NAME, i) < 0)
-			continue;
-
-		fd = open(node, O_RDWR, 0);
-		free(node);
-		if (fd < 0)
-			continue;
-
-		version = drmGetVersion(fd);
-		if (!version) {
-			close(fd);
-			continue;
-		}
+	// MINIGBM_BACKEND=sw skips the DRM nodes and uses the software backend only
+	if (!backend || strcmp(backend, "sw"))
+		num_nodes = drv_find_render_nodes(nodes, ARRAY_SIZE(nodes));
 
+	for (int i = 0; i < num_nodes; i++) {
 		for (j = 0; j < ARRAY_SIZE(undesired); j++) {
-			if (undesired[j] && !strcmp(version->name, undesired[j])) {
-				drmFreeVersion(version);
-				close(fd);
+			if (undesired[j] && !strcmp(nodes[i].name, undesired[j]))
 				break;
-			}
 		}
 
 		// hit any of undesired render node
-		if (j < ARRAY_SIZE(undesired))
+		if (j < ARRAY_SIZE(undesired) || availabe_node == render_num) {
+			close(nodes[i].fd);
 			continue;
+		}
 
-		if (!strcmp(version->name, "virtio_gpu")) {
+		if (!strcmp(nodes[i].name, "virtio_gpu")) {
 			virtio_node_idx = availabe_node;
 		}
 
-		node_fd[availabe_node] = fd;
-		int len = snprintf(NULL, 0, version->name);
-		node_name[availabe_node] = (char *)malloc(len + 1);
-		strcpy(node_name[availabe_node], version->name);
+		node_fd[availabe_node] = nodes[i].fd;
+		node_name[availabe_node] = nodes[i].name;
 		availabe_node++;
-
-		drmFreeVersion(version);
 	}
 
 	// open the first render node
@@ -144,25 +167,15 @@ int32_t cros_gralloc_driver::init()
 		switch (availabe_node) {
 		// only have one render node, is GVT-d/BM/VirtIO
 		case 1:
-			if (drv_render_) {
-				drv_kms_ = drv_render_;
-			} else
-				goto fail;
 			gpu_grp_type = (virtio_node_idx != -1)? ONE_GPU_VIRTIO: ONE_GPU_INTEL;
 			break;
 		// is SR-IOV or iGPU + dGPU
 		case 2:
 			if (virtio_node_idx != -1) {
-				drv_kms_ = drv_create(node_fd[virtio_node_idx]);
-				if (!drv_kms_) {
-					drv_log("Failed to create driver for virtio device\n");
-					close(node_fd[virtio_node_idx]);
-					goto fail;
-				}
+				kms_fd_ = node_fd[virtio_node_idx];
 				gpu_grp_type = TWO_GPU_IGPU_VIRTIO;
 			} else {
 				close(node_fd[1]);
-				drv_kms_ = drv_render_;
 				gpu_grp_type = TWO_GPU_IGPU_DGPU;
 			}
 			break;
@@ -172,60 +185,44 @@ int32_t cros_gralloc_driver::init()
 				close(node_fd[1]);
 			}
 			if (virtio_node_idx != -1) {
-				drv_kms_ = drv_create(node_fd[virtio_node_idx]);
-				if (!drv_kms_) {
-					drv_log("Failed to create driver for virtio device\n");
-					close(node_fd[virtio_node_idx]);
-					goto fail;
-				}
+				kms_fd_ = node_fd[virtio_node_idx];
 			}
 			gpu_grp_type = THREE_GPU_IGPU_VIRTIO_DGPU;
 			// TO-DO: the 3rd node is i915 or others.
 			break;
 		}
 
-		if (drv_render_) {
-			if (drv_init(drv_render_, gpu_grp_type)) {
-				drv_log("Failed to init render driver\n");
-				goto fail;
-			}
+		if (drv_init(drv_render_, gpu_grp_type)) {
+			drv_log("Failed to init render driver\n");
+			goto fail;
 		}
 
-		if (drv_kms_ && (drv_kms_ != drv_render_)) {
-			if (drv_init(drv_kms_, gpu_grp_type)) {
-				drv_log("Failed to init kms driver\n");
-				goto fail;
-			}
+		// a separate display driver is created by get_drv_kms() on first use
+		kms_grp_type_ = gpu_grp_type;
+		if (kms_fd_ < 0)
+			drv_kms_ = drv_render_;
+	} else {
+		// no usable DRM device, fall back to memfd backed buffers
+		drv_render_ = drv_create(-1);
+		if (!drv_render_) {
+			drv_log("Failed to create software driver\n");
+			goto fail;
 		}
-	}
 
-	for (int i = 0; i < availabe_node; i++) {
-		free(node_name[i]);
+		if (drv_init(drv_render_, gpu_grp_type)) {
+			drv_log("Failed to init software driver\n");
+			goto fail;
+		}
+		drv_kms_ = drv_render_;
 	}
 
-	if (!drv_render_ && !drv_kms_)
+	if (!drv_render_)
 		return -ENODEV;
 
 	return 0;
 
 fail:
-	if (drv_kms_) {
-		fd = drv_get_fd(drv_kms_);
-		drv_destroy(drv_kms_);
-		close(fd);
-		drv_kms_ = nullptr;
-	}
-
-	if (drv_render_) {
-		fd = drv_get_fd(drv_render_);
-		drv_destroy(drv_render_);
-		close(fd);
-		drv_render_ = nullptr;
-	}
-
-	for (int i = 0; i < availabe_node; i++) {
-		free(node_name[i]);
-	}
+	destroy_drivers();
 
 	return -ENODEV;
 }
@@ -235,7 +232,7 @@ bool cros_gralloc_driver::is_supported(struct cros_gralloc_buffer_descriptor *de
 	struct combination *combo;
 	uint32_t resolved_format;
 	bool supported;
-	struct driver *drv = (descriptor->use_flags & BO_USE_SCANOUT) ? drv_kms_ : drv_render_;
+	struct driver *drv = (descriptor->use_flags & BO_USE_SCANOUT) ? get_drv_kms() : drv_render_;
 
 	resolved_format = drv_resolve_format(drv, descriptor->drm_format, descriptor->use_flags);
 	combo = drv_get_combination(drv, resolved_format, descriptor->use_flags);
@@ -265,12 +262,110 @@ bool cros_gralloc_driver::is_supported(struct cros_gralloc_buffer_descriptor *de
 	return supported;
 }
 
-int32_t create_reserved_region(const std::string &buffer_name, uint64_t reserved_region_size)
+/* Uses for which the render GPU accesses a buffer. */
+static constexpr uint64_t render_device_use_flags = BO_USE_RENDERING | BO_USE_TEXTURE |
+						    BO_USE_HW_VIDEO_DECODER |
+						    BO_USE_HW_VIDEO_ENCODER | BO_USE_RENDERSCRIPT;
+
+/*
+ * With separate display and render devices, a scanout buffer is drawn by the render GPU and
+ * scanned out by the display, which can only scan out memory it allocated itself. Picks the
+ * display's most preferred modifier that the render GPU can use as well, so that neither side
+ * needs a copy. A valid *modifier on entry, such as one the client asked for, is the only
+ * candidate. Returns the CROS_GRALLOC_DEVICE_* that can use the buffer as allocated;
+ * *modifier is only changed when it names both devices of a split setup.
+ */
+uint32_t cros_gralloc_driver::negotiate_modifier(uint32_t format, uint64_t use_flags,
+						 uint64_t *modifier)
+{
+	uint64_t kms_modifiers[DRV_MAX_FORMAT_MODIFIERS];
+	uint64_t render_modifiers[DRV_MAX_FORMAT_MODIFIERS];
+	struct driver *kms;
+	int num_kms, num_render;
+
+	if (!(use_flags & BO_USE_SCANOUT))
+		return CROS_GRALLOC_DEVICE_RENDER;
+
+	kms = get_drv_kms();
+	if (kms == drv_render_)
+		return CROS_GRALLOC_DEVICE_RENDER | CROS_GRALLOC_DEVICE_KMS;
+
+	/* Buffers that only the CPU fills never reach the render GPU. */
+	if (!(use_flags & render_device_use_flags))
+		return CROS_GRALLOC_DEVICE_KMS;
+
+	if (*modifier != DRM_FORMAT_MOD_INVALID) {
+		kms_modifiers[0] = *modifier;
+		num_kms = 1;
+	} else {
+		num_kms = drv_get_format_modifiers(kms, format, use_flags, kms_modifiers,
+						   ARRAY_SIZE(kms_modifiers));
+	}
+	num_render = drv_get_format_modifiers(
+	    drv_render_, format, use_flags & (render_device_use_flags | BO_USE_LINEAR),
+	    render_modifiers, ARRAY_SIZE(render_modifiers));
+	num_kms = MIN(num_kms, static_cast<int>(ARRAY_SIZE(kms_modifiers)));
+	num_render = MIN(num_render, static_cast<int>(ARRAY_SIZE(render_modifiers)));
+
+	for (int i = 0; i < num_kms; i++) {
+		for (int j = 0; j < num_render; j++) {
+			if (kms_modifiers[i] == render_modifiers[j]) {
+				*modifier = kms_modifiers[i];
+				return CROS_GRALLOC_DEVICE_RENDER | CROS_GRALLOC_DEVICE_KMS;
+			}
+		}
+	}
+
+	drv_log("No modifier shared by the display and render devices.\n");
+	return CROS_GRALLOC_DEVICE_KMS;
+}
+
+/*
+ * Picks the device to import hnd on: the render GPU if it accesses the buffer, the display
+ * otherwise, as long as the layout was negotiated with it. Other layouts are only known to
+ * suit the allocating device. Returns nullptr if the handle doesn't even name that one.
+ */
+struct driver *cros_gralloc_driver::get_import_drv(cros_gralloc_handle_t hnd)
+{
+	struct driver *kms = get_drv_kms();
+	uint32_t allocator;
+
+	if (kms == drv_render_)
+		return drv_render_;
+
+	allocator = hnd->from_kms ? CROS_GRALLOC_DEVICE_KMS : CROS_GRALLOC_DEVICE_RENDER;
+
+	/* Handles that predate negotiation only name the allocating device. */
+	if (!hnd->devices)
+		return hnd->from_kms ? kms : drv_render_;
+
+	if ((hnd->use_flags & render_device_use_flags) &&
+	    (hnd->devices & CROS_GRALLOC_DEVICE_RENDER))
+		return drv_render_;
+
+	if (!(hnd->use_flags & render_device_use_flags) &&
+	    (hnd->devices & CROS_GRALLOC_DEVICE_KMS))
+		return kms;
+
+	if (!(hnd->devices & allocator))
+		return nullptr;
+
+	return hnd->from_kms ? kms : drv_render_;
+}
+
+/*
+ * Every buffer gets a memfd of its own: the handle travels to other processes, which must not
+ * see other buffers' regions or resize this one under its users. Writes stay allowed, the
+ * region is metadata that any holder of the buffer may update.
+ */
+static int32_t create_reserved_region(const std::string &buffer_name,
+				      uint64_t reserved_region_size)
 {
 	int32_t reserved_region_fd;
 	std::string reserved_region_name = buffer_name + " reserved region";
 
-	reserved_region_fd = memfd_create(reserved_region_name.c_str(), FD_CLOEXEC);
+	reserved_region_fd =
+	    memfd_create(reserved_region_name.c_str(), MFD_CLOEXEC | MFD_ALLOW_SEALING);
 	if (reserved_region_fd == -1) {
 		drv_log("Failed to create reserved region fd: %s.\n", strerror(errno));
 		return -errno;
@@ -278,19 +373,31 @@ int32_t create_reserved_region(const std::string &buffer_name, uint64_t reserved
 
 	if (ftruncate(reserved_region_fd, reserved_region_size)) {
 		drv_log("Failed to set reserved region size: %s.\n", strerror(errno));
+		close(reserved_region_fd);
+		return -errno;
+	}
+
+	if (fcntl(reserved_region_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)) {
+		drv_log("Failed to seal reserved region: %s.\n", strerror(errno));
+		close(reserved_region_fd);
 		return -errno;
 	}
 
 	return reserved_region_fd;
 }
 
+static uint64_t cros_gralloc_buffer_key(uint32_t handle, uint32_t offset)
+{
+	return (static_cast<uint64_t>(offset) << 32) | handle;
+}
+
 int32_t cros_gralloc_driver::allocate(const struct cros_gralloc_buffer_descriptor *descriptor,
 				      buffer_handle_t *out_handle)
 {
 #ifdef USE_GRALLOC1
 	uint64_t mod;
 #endif
-	uint32_t id;
+	uint64_t id;
 	size_t num_planes;
 	size_t num_fds;
 	size_t num_ints;
@@ -299,20 +406,28 @@ int32_t cros_gralloc_driver::allocate(const struct cros_gralloc_buffer_descripto
 	uint32_t bytes_per_pixel;
 	uint64_t use_flags;
 	int32_t reserved_region_fd;
+	uint64_t modifier = DRM_FORMAT_MOD_INVALID;
+	uint32_t devices;
 	char *name;
-	bool from_kms = false;
+	bool from_kms;
+	bool client_modifier = false;
+	struct combination *combo;
 
 	struct bo *bo;
 	struct cros_gralloc_handle *hnd;
 
 	struct driver *drv;
+	struct driver *kms;
 
-	if ((descriptor->use_flags & BO_USE_SCANOUT)) {
-		from_kms = true;
-		drv = drv_kms_;
-	} else {
-		drv = drv_render_;
-	}
+	CROS_GRALLOC_TRACE("allocate " DRV_TRACE_FOURCC " %ux%u use=0x%llx usage=0x%x",
+			   DRV_TRACE_FOURCC_ARGS(descriptor->drm_format), descriptor->width,
+			   descriptor->height, (unsigned long long)descriptor->use_flags,
+			   descriptor->droid_usage);
+
+	/* Only a separate display device needs to allocate the scanout buffers itself. */
+	kms = (descriptor->use_flags & BO_USE_SCANOUT) ? get_drv_kms() : nullptr;
+	from_kms = kms && kms != drv_render_;
+	drv = from_kms ? kms : drv_render_;
 
 	resolved_format = drv_resolve_format(drv, descriptor->drm_format, descriptor->use_flags);
 	use_flags = descriptor->use_flags;
@@ -335,16 +450,36 @@ int32_t cros_gralloc_driver::allocate(const struct cros_gralloc_buffer_descripto
 	}
 
 #ifdef USE_GRALLOC1
-	if (descriptor->modifier == 0) {
+	if (descriptor->modifier != 0) {
+		modifier = descriptor->modifier;
+		client_modifier = true;
+	}
+#endif
+	devices = negotiate_modifier(resolved_format, use_flags, &modifier);
+
+	/*
+	 * drv_bo_create() already gives the buffer its combination's layout, and backends without
+	 * modifier support can only allocate that one. A negotiated modifier they can't honour
+	 * leaves the buffer with the allocating device's default layout, as before negotiation.
+	 */
+	if (modifier != DRM_FORMAT_MOD_INVALID) {
+		combo = drv_get_combination(drv, resolved_format, use_flags);
+		if (combo && combo->metadata.modifier == modifier) {
+			modifier = DRM_FORMAT_MOD_INVALID;
+		} else if (!drv_supports_modifiers(drv) && !client_modifier) {
+			modifier = DRM_FORMAT_MOD_INVALID;
+			devices = from_kms ? CROS_GRALLOC_DEVICE_KMS : CROS_GRALLOC_DEVICE_RENDER;
+		}
+	}
+
+	if (modifier != DRM_FORMAT_MOD_INVALID) {
+		bo = drv_bo_create_with_modifiers_and_use_flags(drv, descriptor->width,
+								descriptor->height, resolved_format,
+								use_flags, &modifier, 1);
+	} else {
 		bo = drv_bo_create(drv, descriptor->width, descriptor->height, resolved_format,
 				   use_flags);
-	} else {
-		bo = drv_bo_create_with_modifiers(drv, descriptor->width, descriptor->height,
-						  resolved_format, &descriptor->modifier, 1);
 	}
-#else
-	bo = drv_bo_create(drv, descriptor->width, descriptor->height, resolved_format, use_flags);
-#endif
 	if (!bo) {
 		drv_log("Failed to create bo.\n");
 		return -ENOMEM;
@@ -390,6 +525,7 @@ int32_t cros_gralloc_driver::allocate(const struct cros_gralloc_buffer_descripto
 	 */
 	hnd = static_cast<struct cros_gralloc_handle *>(malloc(num_bytes));
 	hnd->from_kms = from_kms;
+	hnd->devices = devices;
 	hnd->base.version = sizeof(hnd->base);
 	hnd->base.numFds = num_fds;
 	hnd->base.numInts = num_ints;
@@ -436,7 +572,9 @@ int32_t cros_gralloc_driver::allocate(const struct cros_gralloc_buffer_descripto
 	name = (char *)(&hnd->base.data[hnd->name_offset]);
 	snprintf(name, descriptor->name.size() + 1, "%s", descriptor->name.c_str());
 
-	id = drv_bo_get_plane_handle(bo, 0).u32;
+	CROS_GRALLOC_TRACE_HANDLE("allocate_register", hnd);
+	id = cros_gralloc_buffer_key(drv_bo_get_plane_handle(bo, 0).u32,
+				     drv_bo_get_plane_offset(bo, 0));
 	auto buffer = new cros_gralloc_buffer(id, bo, hnd, hnd->fds[hnd->num_planes],
 					      hnd->reserved_region_size);
 
@@ -449,9 +587,12 @@ int32_t cros_gralloc_driver::allocate(const struct cros_gralloc_buffer_descripto
 
 int32_t cros_gralloc_driver::retain(buffer_handle_t handle)
 {
-	uint32_t id;
+	uint32_t gem_handle;
+	uint64_t id;
 	std::lock_guard<std::mutex> lock(mutex_);
 	struct driver *drv;
+	struct bo *bo;
+	struct drv_import_fd_data data;
 
 	auto hnd = cros_gralloc_convert_handle(handle);
 	if (!hnd) {
@@ -459,7 +600,7 @@ int32_t cros_gralloc_driver::retain(buffer_handle_t handle)
 		return -EINVAL;
 	}
 
-	drv = (hnd->from_kms) ? drv_kms_ : drv_render_;
+	CROS_GRALLOC_TRACE_HANDLE("retain", hnd);
 
 	auto buffer = get_buffer(hnd);
 	if (buffer) {
@@ -468,36 +609,54 @@ int32_t cros_gralloc_driver::retain(buffer_handle_t handle)
 		return 0;
 	}
 
-	if (drmPrimeFDToHandle(drv_get_fd(drv), hnd->fds[0], &id)) {
+	drv = get_import_drv(hnd);
+	if (!drv) {
+		drv_log("Buffer handle names no device that can use its layout.\n");
+		return -EINVAL;
+	}
+
+	// The software backend has no GEM handles to dedupe against
+	if (drv_get_fd(drv) < 0) {
+		id = 0;
+	} else if (drmPrimeFDToHandle(drv_get_fd(drv), hnd->fds[0], &gem_handle)) {
 		drv_log("drmPrimeFDToHandle failed.\n");
 		return -errno;
+	} else {
+		id = cros_gralloc_buffer_key(gem_handle, hnd->offsets[0]);
 	}
 
-	if (buffers_.count(id)) {
+	if (id && buffers_.count(id)) {
 		buffer = buffers_[id];
 		buffer->increase_refcount();
-	} else {
-		struct bo *bo;
-		struct drv_import_fd_data data;
-		data.format = hnd->format;
-
-		data.width = hnd->width;
-		data.height = hnd->height;
-		data.use_flags = hnd->use_flags;
-
-		memcpy(data.fds, hnd->fds, sizeof(data.fds));
-		memcpy(data.strides, hnd->strides, sizeof(data.strides));
-		memcpy(data.offsets, hnd->offsets, sizeof(data.offsets));
-		for (uint32_t plane = 0; plane < DRV_MAX_PLANES; plane++) {
-			data.format_modifiers[plane] = hnd->format_modifier;
-		}
+		handles_.emplace(hnd, std::make_pair(buffer, 1));
+		return 0;
+	}
+
+	data.format = hnd->format;
+	data.width = hnd->width;
+	data.height = hnd->height;
+	data.use_flags = hnd->use_flags;
 
-		bo = drv_bo_import(drv, &data);
-		if (!bo)
-			return -EFAULT;
+	memcpy(data.fds, hnd->fds, sizeof(data.fds));
+	memcpy(data.strides, hnd->strides, sizeof(data.strides));
+	memcpy(data.offsets, hnd->offsets, sizeof(data.offsets));
+	for (uint32_t plane = 0; plane < DRV_MAX_PLANES; plane++) {
+		data.format_modifiers[plane] = hnd->format_modifier;
+	}
 
-		id = drv_bo_get_plane_handle(bo, 0).u32;
+	bo = drv_bo_import(drv, &data);
+	if (!bo)
+		return -EFAULT;
 
+	id = cros_gralloc_buffer_key(drv_bo_get_plane_handle(bo, 0).u32,
+				     drv_bo_get_plane_offset(bo, 0));
+
+	/* Without GEM handles, a buffer we already hold only shows up through the import. */
+	if (buffers_.count(id)) {
+		buffer = buffers_[id];
+		buffer->increase_refcount();
+		drv_bo_destroy(bo);
+	} else {
 		buffer = new cros_gralloc_buffer(id, bo, nullptr, hnd->fds[hnd->num_planes],
 						 hnd->reserved_region_size);
 		buffers_.emplace(id, buffer);
@@ -517,6 +676,8 @@ int32_t cros_gralloc_driver::release(buffer_handle_t handle)
 		return -EINVAL;
 	}
 
+	CROS_GRALLOC_TRACE_HANDLE("release", hnd);
+
 	auto buffer = get_buffer(hnd);
 	if (!buffer) {
 		drv_log("Invalid Reference.\n");
@@ -549,6 +710,8 @@ int32_t cros_gralloc_driver::lock(buffer_handle_t handle, int32_t acquire_fence,
 		return -EINVAL;
 	}
 
+	CROS_GRALLOC_TRACE_HANDLE("lock", hnd);
+
 	auto buffer = get_buffer(hnd);
 	if (!buffer) {
 		drv_log("Invalid Reference.\n");
@@ -573,6 +736,8 @@ int32_t cros_gralloc_driver::lock(buffer_handle_t handle, int32_t acquire_fence,
                 return -EINVAL;
         }
 
+        CROS_GRALLOC_TRACE_HANDLE("lock", hnd);
+
         auto buffer = get_buffer(hnd);
         if (!buffer) {
                 drv_log("Invalid Reference.");
@@ -593,6 +758,8 @@ int32_t cros_gralloc_driver::unlock(buffer_handle_t handle, int32_t *release_fen
 		return -EINVAL;
 	}
 
+	CROS_GRALLOC_TRACE_HANDLE("unlock", hnd);
+
 	auto buffer = get_buffer(hnd);
 	if (!buffer) {
 		drv_log("Invalid Reference.\n");
@@ -604,9 +771,10 @@ int32_t cros_gralloc_driver::unlock(buffer_handle_t handle, int32_t *release_fen
 	 *
 	 * "A value of -1 indicates that the caller may access the buffer immediately without
 	 * waiting on a fence."
+	 *
+	 * Otherwise the fence covers the flush, which may still be running.
 	 */
-	*release_fence = -1;
-	return buffer->unlock();
+	return buffer->unlock(release_fence);
 }
 
 int32_t cros_gralloc_driver::invalidate(buffer_handle_t handle)
@@ -619,6 +787,8 @@ int32_t cros_gralloc_driver::invalidate(buffer_handle_t handle)
 		return -EINVAL;
 	}
 
+	CROS_GRALLOC_TRACE_HANDLE("invalidate", hnd);
+
 	auto buffer = get_buffer(hnd);
 	if (!buffer) {
 		drv_log("Invalid Reference.\n");
@@ -638,6 +808,8 @@ int32_t cros_gralloc_driver::flush(buffer_handle_t handle, int32_t *release_fenc
 		return -EINVAL;
 	}
 
+	CROS_GRALLOC_TRACE_HANDLE("flush", hnd);
+
 	auto buffer = get_buffer(hnd);
 	if (!buffer) {
 		drv_log("Invalid Reference.\n");
@@ -649,9 +821,10 @@ int32_t cros_gralloc_driver::flush(buffer_handle_t handle, int32_t *release_fenc
 	 *
 	 * "A value of -1 indicates that the caller may access the buffer immediately without
 	 * waiting on a fence."
+	 *
+	 * Otherwise the fence covers the flush, which may still be running.
 	 */
-	*release_fence = -1;
-	return buffer->flush();
+	return buffer->flush(release_fence);
 }
 
 int32_t cros_gralloc_driver::get_backing_store(buffer_handle_t handle, uint64_t *out_store)
@@ -721,7 +894,7 @@ int32_t cros_gralloc_driver::get_reserved_region(buffer_handle_t handle,
 
 uint32_t cros_gralloc_driver::get_resolved_drm_format(uint32_t drm_format, uint64_t usage)
 {
-	struct driver *drv = (usage & BO_USE_SCANOUT) ? drv_kms_ : drv_render_;
+	struct driver *drv = (usage & BO_USE_SCANOUT) ? get_drv_kms() : drv_render_;
 
 	return drv_resolve_format(drv, drm_format, usage);
 }
@@ -745,6 +918,38 @@ void cros_gralloc_driver::for_each_handle(
 	}
 }
 
+template <typename Dump> static void append_report(std::string &report, Dump dump)
+{
+	size_t start = report.size();
+	int len = dump(nullptr, 0);
+
+	if (len > 0) {
+		report.resize(start + len + 1);
+		dump(&report[start], len + 1);
+		report.resize(start + len);
+	}
+}
+
+std::string cros_gralloc_driver::dump()
+{
+	std::string report;
+
+	append_report(report, drv_stats_dump);
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (drv_render_)
+		append_report(report, [this](char *buf, size_t size) {
+			return drv_mem_dump(drv_render_, buf, size);
+		});
+	struct driver *kms = drv_kms_.load(std::memory_order_acquire);
+	if (kms && kms != drv_render_)
+		append_report(report, [kms](char *buf, size_t size) {
+			return drv_mem_dump(kms, buf, size);
+		});
+
+	return report;
+}
+
 bool cros_gralloc_driver::IsSupportedYUVFormat(uint32_t droid_format)
 {
 	switch (droid_format) {
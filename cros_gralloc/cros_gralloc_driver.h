@@ -9,8 +9,10 @@
 
 #include "cros_gralloc_buffer.h"
 
+#include <atomic>
 #include <functional>
 #include <mutex>
+#include <string>
 #include <unordered_map>
 
 class cros_gralloc_driver
@@ -50,9 +52,11 @@ class cros_gralloc_driver
 
 	void for_each_handle(const std::function<void(cros_gralloc_handle_t)> &function);
 
+	std::string dump();
+
 	bool is_kmsro_enabled()
 	{
-		return drv_kms_ != drv_render_;
+		return get_drv_kms() != drv_render_;
 	};
 	bool IsSupportedYUVFormat(uint32_t droid_format);
 
@@ -60,11 +64,20 @@ class cros_gralloc_driver
 	cros_gralloc_driver(cros_gralloc_driver const &);
 	cros_gralloc_driver operator=(cros_gralloc_driver const &);
 	cros_gralloc_buffer *get_buffer(cros_gralloc_handle_t hnd);
+	struct driver *get_drv_kms();
+	void destroy_drivers();
+	uint32_t negotiate_modifier(uint32_t format, uint64_t use_flags, uint64_t *modifier);
+	struct driver *get_import_drv(cros_gralloc_handle_t hnd);
 
-	struct driver *drv_kms_;
+	std::atomic<struct driver *> drv_kms_;
 	struct driver *drv_render_;
+	// display node fd and group type until the kms driver is created
+	int kms_fd_;
+	uint32_t kms_grp_type_;
+	std::mutex kms_mutex_;
 	std::mutex mutex_;
-	std::unordered_map<uint32_t, cros_gralloc_buffer *> buffers_;
+	/* Keyed by GEM handle and offset, as small buffers can share a GEM object. */
+	std::unordered_map<uint64_t, cros_gralloc_buffer *> buffers_;
 	std::unordered_map<cros_gralloc_handle_t, std::pair<cros_gralloc_buffer *, int32_t>>
 	    handles_;
 };
@@ -13,6 +13,10 @@
 #define DRV_MAX_PLANES 4
 #define DRV_MAX_FDS (DRV_MAX_PLANES + 1)
 
+/* Devices in cros_gralloc_handle::devices. */
+#define CROS_GRALLOC_DEVICE_RENDER (1 << 0)
+#define CROS_GRALLOC_DEVICE_KMS (1 << 1)
+
 struct cros_gralloc_handle {
 	native_handle_t base;
 	/*
@@ -28,6 +32,12 @@ struct cros_gralloc_handle {
 	uint32_t offsets[DRV_MAX_PLANES];
 	uint32_t sizes[DRV_MAX_PLANES];
 	bool from_kms;
+	/*
+	 * The devices the layout was negotiated with at allocation time. Each of them can use
+	 * the buffer with format_modifier as is; importers use this to pick their device and
+	 * refuse a buffer the device they need cannot use.
+	 */
+	uint32_t devices;
 	uint32_t id;
 	uint32_t width;
 	uint32_t height;
@@ -9,6 +9,7 @@
 #include "i915_private_android_types.h"
 
 #include <sync/sync.h>
+#include <time.h>
 
 #ifdef USE_GRALLOC1
 #include "i915_private_android.h"
@@ -106,6 +107,36 @@ cros_gralloc_handle_t cros_gralloc_convert_handle(buffer_handle_t handle)
 	return hnd;
 }
 
+#ifdef USE_TRACE
+static int64_t cros_gralloc_now_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+#endif
+
+/* Waits on the fence, tracing the wait and reporting its length as a counter. */
+static int cros_gralloc_traced_sync_wait(int32_t fence, int timeout)
+{
+	int err;
+#ifdef USE_TRACE
+	int64_t start = cros_gralloc_now_us();
+#endif
+
+	CROS_GRALLOC_TRACE("sync_wait fence=%d timeout=%d", fence, timeout);
+	err = sync_wait(fence, timeout);
+#ifdef USE_TRACE
+	/* Callers report failures through errno, keep it intact. */
+	int saved_errno = errno;
+	DRV_TRACE_COUNTER("gralloc_sync_wait_us", cros_gralloc_now_us() - start);
+	errno = saved_errno;
+#endif
+
+	return err;
+}
+
 int32_t cros_gralloc_sync_wait(int32_t fence, bool close_fence)
 {
 	if (fence < 0)
@@ -115,10 +146,10 @@ int32_t cros_gralloc_sync_wait(int32_t fence, bool close_fence)
 	 * Wait initially for 1000 ms, and then wait indefinitely. The SYNC_IOC_WAIT
 	 * documentation states the caller waits indefinitely on the fence if timeout < 0.
 	 */
-	int err = sync_wait(fence, 1000);
+	int err = cros_gralloc_traced_sync_wait(fence, 1000);
 	if (err < 0) {
 		drv_log("Timed out on sync wait, err = %s\n", strerror(errno));
-		err = sync_wait(fence, -1);
+		err = cros_gralloc_traced_sync_wait(fence, -1);
 		if (err < 0) {
 			drv_log("sync wait error = %s\n", strerror(errno));
 			return -errno;
@@ -146,10 +177,10 @@ int32_t cros_gralloc_sync_wait(int32_t acquire_fence)
          * Wait initially for 1000 ms, and then wait indefinitely. The SYNC_IOC_WAIT
          * documentation states the caller waits indefinitely on the fence if timeout < 0.
          */
-        int err = sync_wait(acquire_fence, 1000);
+        int err = cros_gralloc_traced_sync_wait(acquire_fence, 1000);
         if (err < 0) {
                 drv_log("Timed out on sync wait, err = %s", strerror(errno));
-                err = sync_wait(acquire_fence, -1);
+                err = cros_gralloc_traced_sync_wait(acquire_fence, -1);
                 if (err < 0) {
                         drv_log("sync wait error = %s", strerror(errno));
                         return -errno;
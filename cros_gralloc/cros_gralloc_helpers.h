@@ -8,6 +8,7 @@
 #define CROS_GRALLOC_HELPERS_H
 
 #include "../drv.h"
+#include "../trace.h"
 #include "cros_gralloc_handle.h"
 #include "cros_gralloc_types.h"
 
@@ -18,6 +19,19 @@ constexpr uint32_t cros_gralloc_magic = 0xABCDDCBA;
 constexpr uint32_t handle_data_size =
     ((sizeof(struct cros_gralloc_handle) - offsetof(cros_gralloc_handle, fds[0])) / sizeof(int));
 
+/*
+ * Lock usage hint: the caller overwrites the whole locked region, so its old contents are not
+ * read back. It has to sit in a bit each HAL leaves to the vendor:
+ * - gralloc0 usage is an int, whose only vendor bits are GRALLOC_USAGE_PRIVATE_0..3 (28-31).
+ *   PRIVATE_3 is used.
+ * - gralloc1 producer usage and gralloc4 BufferUsage share one 64-bit layout with vendor
+ *   bits 28-31 (VENDOR_MASK) and 48-63 (VENDOR_MASK_HI). Bits 28-31 alias the gralloc0
+ *   private bits that the framework passes through for legacy clients, so the hint uses bit
+ *   62 of the high range, the top bit that keeps the AIDL long positive.
+ */
+constexpr uint32_t cros_gralloc0_usage_discard = 1U << 31;
+constexpr uint64_t cros_gralloc_usage_discard = 1ULL << 62;
+
 uint32_t cros_gralloc_convert_format(int32_t format);
 
 cros_gralloc_handle_t cros_gralloc_convert_handle(buffer_handle_t handle);
@@ -26,6 +40,33 @@ int32_t cros_gralloc_sync_wait(int32_t fence, bool close_fence);
 
 bool flex_format_match(uint32_t descriptor_format, uint32_t handle_format, uint64_t usage = 0);
 
+#ifdef USE_TRACE
+class cros_gralloc_trace_span
+{
+      public:
+	template <typename... Args> explicit cros_gralloc_trace_span(const char *format, Args... args)
+	{
+		DRV_TRACE_BEGIN(format, args...);
+	}
+	~cros_gralloc_trace_span()
+	{
+		DRV_TRACE_END();
+	}
+	cros_gralloc_trace_span(const cros_gralloc_trace_span &) = delete;
+	cros_gralloc_trace_span &operator=(const cros_gralloc_trace_span &) = delete;
+};
+
+#define CROS_GRALLOC_TRACE_CONCAT2(a, b) a##b
+#define CROS_GRALLOC_TRACE_CONCAT(a, b) CROS_GRALLOC_TRACE_CONCAT2(a, b)
+/* Traces the rest of the enclosing scope. */
+#define CROS_GRALLOC_TRACE(...)                                                                    \
+	cros_gralloc_trace_span CROS_GRALLOC_TRACE_CONCAT(trace_span_, __LINE__)(__VA_ARGS__)
+#else
+#define CROS_GRALLOC_TRACE(...)                                                                    \
+	do {                                                                                       \
+	} while (0)
+#endif
+
 #ifdef USE_GRALLOC1
 int32_t cros_gralloc_sync_wait(int32_t acquire_fence);
 const char *drmFormat2Str(int format);
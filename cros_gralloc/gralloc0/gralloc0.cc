@@ -97,6 +97,8 @@ static uint32_t gralloc0_convert_map_usage(int map_usage)
 		map_flags |= BO_MAP_READ;
 	if (map_usage & GRALLOC_USAGE_SW_WRITE_MASK)
 		map_flags |= BO_MAP_WRITE;
+	if (static_cast<uint32_t>(map_usage) & cros_gralloc0_usage_discard)
+		map_flags |= BO_MAP_DISCARD;
 
 	return map_flags;
 }
@@ -21,6 +21,7 @@
 
 #include <hardware/gralloc.h>
 
+#include <algorithm>
 #include <inttypes.h>
 
 #include "i915_private_android.h"
@@ -100,6 +101,8 @@ uint64_t cros_gralloc1_convert_map_usage(uint64_t producer_flags, uint64_t consu
 		usage |= BO_MAP_WRITE;
 	if (producer_flags & GRALLOC1_PRODUCER_USAGE_CPU_WRITE_OFTEN)
 		usage |= BO_MAP_WRITE;
+	if (producer_flags & cros_gralloc_usage_discard)
+		usage |= BO_MAP_DISCARD;
 
 	return usage;
 }
@@ -243,7 +246,19 @@ gralloc1_function_pointer_t CrosGralloc1::doGetFunction(int32_t intDescriptor)
 
 void CrosGralloc1::dump(uint32_t *outSize, char *outBuffer)
 {
-	drv_log("dump(%u (%p), %p", outSize ? *outSize : 0, outSize, outBuffer);
+	if (!outSize || !driver)
+		return;
+
+	std::string report = driver->dump();
+
+	// The first call queries the size, the second one copies the report.
+	if (!outBuffer) {
+		*outSize = report.size();
+		return;
+	}
+
+	*outSize = std::min<uint32_t>(*outSize, report.size());
+	memcpy(outBuffer, report.data(), *outSize);
 }
 
 int32_t CrosGralloc1::createDescriptor(gralloc1_buffer_descriptor_t *outDescriptor)
@@ -491,6 +491,9 @@ int convertToMapUsage(uint64_t grallocUsage, uint32_t* outMapUsage) {
     if (grallocUsage & BufferUsage::CPU_WRITE_MASK) {
         mapUsage |= BO_MAP_WRITE;
     }
+    if (grallocUsage & cros_gralloc_usage_discard) {
+        mapUsage |= BO_MAP_DISCARD;
+    }
 
     *outMapUsage = mapUsage;
     return 0;
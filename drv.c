@@ -12,6 +12,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <xf86drm.h>
@@ -23,6 +24,11 @@
 
 #include "drv_priv.h"
 #include "helpers.h"
+#include "import_cache.h"
+#include "map_policy.h"
+#include "slab.h"
+#include "stats.h"
+#include "trace.h"
 #include "util.h"
 
 #ifdef USE_GRALLOC1
@@ -52,6 +58,7 @@ extern const struct backend backend_meson;
 extern const struct backend backend_msm;
 #endif
 extern const struct backend backend_nouveau;
+extern const struct backend backend_sw;
 #ifdef DRV_RADEON
 extern const struct backend backend_radeon;
 #endif
@@ -73,64 +80,58 @@ extern const struct backend backend_virtio_gpu;
 #endif
 extern const struct backend backend_vgem;
 
-static const struct backend *drv_get_backend(int fd)
-{
-	drmVersionPtr drm_version;
-	unsigned int i;
-
-	drm_version = drmGetVersion(fd);
-
-	if (!drm_version)
-		return NULL;
-
-	const struct backend *backend_list[] = {
+static const struct backend *drv_backends[] = {
 #ifdef DRV_AMDGPU
-		&backend_amdgpu,
+	&backend_amdgpu,
 #endif
-		&backend_evdi,
+	&backend_evdi,
 #ifdef DRV_EXYNOS
-		&backend_exynos,
+	&backend_exynos,
 #endif
 #ifdef DRV_I915
-		&backend_i915,
+	&backend_i915,
 #endif
 #ifdef DRV_MARVELL
-		&backend_marvell,
+	&backend_marvell,
 #endif
 #ifdef DRV_MEDIATEK
-		&backend_mediatek,
+	&backend_mediatek,
 #endif
 #ifdef DRV_MESON
-		&backend_meson,
+	&backend_meson,
 #endif
 #ifdef DRV_MSM
-		&backend_msm,
+	&backend_msm,
 #endif
-		&backend_nouveau,
+	&backend_nouveau,
 #ifdef DRV_RADEON
-		&backend_radeon,
+	&backend_radeon,
 #endif
 #ifdef DRV_ROCKCHIP
-		&backend_rockchip,
+	&backend_rockchip,
 #endif
 #ifdef DRV_SYNAPTICS
-		&backend_synaptics,
+	&backend_synaptics,
 #endif
 #ifdef DRV_TEGRA
-		&backend_tegra,
+	&backend_tegra,
 #endif
-		&backend_udl,
+	&backend_udl,
 #ifdef DRV_VC4
-		&backend_vc4,
+	&backend_vc4,
 #endif
 #ifdef DRV_VIRTIO_GPU
-		&backend_virtio_gpu,
+	&backend_virtio_gpu,
 #endif
-		&backend_vgem,
-	};
+	&backend_vgem,
+};
+
+static const struct backend *drv_find_backend(const char *name)
+{
+	unsigned int i;
 
-	for (i = 0; i < ARRAY_SIZE(backend_list); i++) {
-		const struct backend *b = backend_list[i];
+	for (i = 0; i < ARRAY_SIZE(drv_backends); i++) {
+		const struct backend *b = drv_backends[i];
 		// Exactly one of the main create functions must be defined.
 		assert((b->bo_create != NULL) ^ (b->bo_create_from_metadata != NULL));
 		// Either both or neither must be implemented.
@@ -139,21 +140,44 @@ static const struct backend *drv_get_backend(int fd)
 		assert((b->bo_create_with_modifiers == NULL) ||
 		       (b->bo_create_from_metadata == NULL));
 
-		if (!strcmp(drm_version->name, b->name)) {
-			drmFreeVersion(drm_version);
+		if (!strcmp(name, b->name))
 			return b;
-		}
 	}
 
-	drmFreeVersion(drm_version);
 	return NULL;
 }
 
+bool drv_is_backend_name(const char *name)
+{
+	return drv_find_backend(name) != NULL;
+}
+
+static const struct backend *drv_get_backend(int fd)
+{
+	char driver_name[32];
+	const char *name;
+
+	/*
+	 * MINIGBM_BACKEND=sw forces the software backend even when a DRM device exists, and a
+	 * negative fd means there is no DRM device at all.
+	 */
+	name = getenv("MINIGBM_BACKEND");
+	if (fd < 0 || (name && !strcmp(name, backend_sw.name)))
+		return &backend_sw;
+
+	if (drv_get_driver_name(fd, driver_name, sizeof(driver_name)))
+		return NULL;
+
+	return drv_find_backend(driver_name);
+}
+
 struct driver *drv_create(int fd)
 {
 	struct driver *drv;
 	int ret;
 
+	drv_stats_init();
+
 	drv = (struct driver *)calloc(1, sizeof(*drv));
 
 	if (!drv)
@@ -180,8 +204,25 @@ struct driver *drv_create(int fd)
 	if (!drv->combos)
 		goto free_mappings;
 
+	drv->slabs = drv_array_init(sizeof(struct drv_slab));
+	if (!drv->slabs)
+		goto free_combos;
+
+	drv->imports = drv_array_init(sizeof(struct drv_import_entry));
+	if (!drv->imports)
+		goto free_slabs;
+
+	if (drv_mem_init(drv))
+		goto free_imports;
+
 	return drv;
 
+free_imports:
+	drv_array_destroy(drv->imports);
+free_slabs:
+	drv_array_destroy(drv->slabs);
+free_combos:
+	drv_array_destroy(drv->combos);
 free_mappings:
 	drv_array_destroy(drv->mappings);
 free_buffer_table:
@@ -202,13 +243,20 @@ int drv_init(struct driver * drv, uint32_t grp_type)
 	drv->gpu_grp_type = grp_type;
 
 	if (drv->backend->init) {
+		if (!drv_init_cache_load(drv))
+			return 0;
+
 		ret = drv->backend->init(drv);
+		if (!ret)
+			drv_init_cache_store(drv);
 	}
 	return ret;
 }
 
 void drv_destroy(struct driver *drv)
 {
+	drv_slab_fini(drv);
+
 	pthread_mutex_lock(&drv->driver_lock);
 
 	if (drv->backend->close)
@@ -217,6 +265,8 @@ void drv_destroy(struct driver *drv)
 	drmHashDestroy(drv->buffer_table);
 	drv_array_destroy(drv->mappings);
 	drv_array_destroy(drv->combos);
+	drv_array_destroy(drv->imports);
+	drv_mem_fini(drv);
 
 	pthread_mutex_unlock(&drv->driver_lock);
 	pthread_mutex_destroy(&drv->driver_lock);
@@ -234,6 +284,13 @@ const char *drv_get_name(struct driver *drv)
 	return drv->backend->name;
 }
 
+void drv_set_map_populate(struct driver *drv, enum drv_map_populate populate)
+{
+	pthread_mutex_lock(&drv->driver_lock);
+	drv->map_populate = populate;
+	pthread_mutex_unlock(&drv->driver_lock);
+}
+
 struct combination *drv_get_combination(struct driver *drv, uint32_t format, uint64_t use_flags)
 {
 	struct combination *curr, *best;
@@ -253,6 +310,58 @@ struct combination *drv_get_combination(struct driver *drv, uint32_t format, uin
 	return best;
 }
 
+static int drv_combination_priority_cmp(const void *a, const void *b)
+{
+	const struct combination *ca = *(const struct combination *const *)a;
+	const struct combination *cb = *(const struct combination *const *)b;
+
+	if (ca->metadata.priority != cb->metadata.priority)
+		return ca->metadata.priority < cb->metadata.priority ? 1 : -1;
+
+	return 0;
+}
+
+int drv_get_format_modifiers(struct driver *drv, uint32_t format, uint64_t use_flags,
+			     uint64_t *modifiers, uint32_t max)
+{
+	struct combination **matches;
+	uint32_t i, j, num_matches = 0, count = 0;
+
+	if (format == DRM_FORMAT_NONE)
+		return -EINVAL;
+
+	matches = calloc(drv_array_size(drv->combos), sizeof(*matches));
+	if (!matches)
+		return -ENOMEM;
+
+	for (i = 0; i < drv_array_size(drv->combos); i++) {
+		struct combination *curr = drv_array_at_idx(drv->combos, i);
+		if (format == curr->format && use_flags == (curr->use_flags & use_flags))
+			matches[num_matches++] = curr;
+	}
+
+	/* Most preferred layout first, matching what drv_get_combination() would pick. */
+	qsort(matches, num_matches, sizeof(*matches), drv_combination_priority_cmp);
+
+	for (i = 0; i < num_matches; i++) {
+		uint64_t modifier = matches[i]->metadata.modifier;
+
+		for (j = 0; j < i; j++)
+			if (matches[j]->metadata.modifier == modifier)
+				break;
+
+		if (j < i)
+			continue;
+
+		if (modifiers && count < max)
+			modifiers[count] = modifier;
+		count++;
+	}
+
+	free(matches);
+	return count;
+}
+
 struct bo *drv_bo_new(struct driver *drv, uint32_t width, uint32_t height, uint32_t format,
 		      uint64_t use_flags, bool is_test_buffer)
 {
@@ -279,23 +388,34 @@ struct bo *drv_bo_new(struct driver *drv, uint32_t width, uint32_t height, uint3
 	return bo;
 }
 
-struct bo *drv_bo_create(struct driver *drv, uint32_t width, uint32_t height, uint32_t format,
-			 uint64_t use_flags)
+static struct bo *drv_bo_create_internal(struct driver *drv, uint32_t width, uint32_t height,
+					 uint32_t format, uint64_t use_flags,
+					 bool is_slab_backing)
 {
 	int ret;
 	size_t plane;
 	struct bo *bo;
 	bool is_test_alloc;
+	uint64_t start;
 
 	is_test_alloc = use_flags & BO_USE_TEST_ALLOC;
 	use_flags &= ~BO_USE_TEST_ALLOC;
 
+	if (!is_test_alloc && !is_slab_backing) {
+		bo = drv_slab_bo_create(drv, width, height, format, use_flags);
+		if (bo)
+			return bo;
+	}
+
 	bo = drv_bo_new(drv, width, height, format, use_flags, is_test_alloc);
 
 	if (!bo)
 		return NULL;
 
 	ret = -EINVAL;
+	DRV_TRACE_BEGIN("drv_bo_create " DRV_TRACE_FOURCC " %ux%u use=0x%llx",
+			DRV_TRACE_FOURCC_ARGS(format), width, height, (unsigned long long)use_flags);
+	start = drv_stats_begin();
 	if (drv->backend->bo_compute_metadata) {
 		ret = drv->backend->bo_compute_metadata(bo, width, height, format, use_flags, NULL,
 							0);
@@ -304,6 +424,8 @@ struct bo *drv_bo_create(struct driver *drv, uint32_t width, uint32_t height, ui
 	} else if (!is_test_alloc) {
 		ret = drv->backend->bo_create(bo, width, height, format, use_flags);
 	}
+	drv_stats_end(DRV_STAT_BO_CREATE, start, ret);
+	DRV_TRACE_END();
 
 	if (ret) {
 		free(bo);
@@ -321,29 +443,63 @@ struct bo *drv_bo_create(struct driver *drv, uint32_t width, uint32_t height, ui
 
 	pthread_mutex_unlock(&drv->driver_lock);
 
+	bo->is_slab_backing = is_slab_backing;
+	if (!is_test_alloc)
+		drv_mem_account(bo, true);
+
 	return bo;
 }
 
+struct bo *drv_bo_create(struct driver *drv, uint32_t width, uint32_t height, uint32_t format,
+			 uint64_t use_flags)
+{
+	return drv_bo_create_internal(drv, width, height, format, use_flags, false);
+}
+
+struct bo *drv_bo_create_slab_backing(struct driver *drv, uint32_t width, uint32_t height,
+				      uint32_t format, uint64_t use_flags)
+{
+	return drv_bo_create_internal(drv, width, height, format, use_flags, true);
+}
+
 struct bo *drv_bo_create_with_modifiers(struct driver *drv, uint32_t width, uint32_t height,
 					uint32_t format, const uint64_t *modifiers, uint32_t count)
+{
+	return drv_bo_create_with_modifiers_and_use_flags(drv, width, height, format, BO_USE_NONE,
+							  modifiers, count);
+}
+
+bool drv_supports_modifiers(struct driver *drv)
+{
+	return drv->backend->bo_create_with_modifiers || drv->backend->bo_compute_metadata;
+}
+
+struct bo *drv_bo_create_with_modifiers_and_use_flags(struct driver *drv, uint32_t width,
+						      uint32_t height, uint32_t format,
+						      uint64_t use_flags, const uint64_t *modifiers,
+						      uint32_t count)
 {
 	int ret;
 	size_t plane;
 	struct bo *bo;
+	uint64_t start;
 
-	if (!drv->backend->bo_create_with_modifiers && !drv->backend->bo_compute_metadata) {
+	if (!drv_supports_modifiers(drv)) {
 		errno = ENOENT;
 		return NULL;
 	}
 
-	bo = drv_bo_new(drv, width, height, format, BO_USE_NONE, false);
+	bo = drv_bo_new(drv, width, height, format, use_flags, false);
 
 	if (!bo)
 		return NULL;
 
 	ret = -EINVAL;
+	DRV_TRACE_BEGIN("drv_bo_create_with_modifiers " DRV_TRACE_FOURCC " %ux%u use=0x%llx",
+			DRV_TRACE_FOURCC_ARGS(format), width, height, (unsigned long long)use_flags);
+	start = drv_stats_begin();
 	if (drv->backend->bo_compute_metadata) {
-		ret = drv->backend->bo_compute_metadata(bo, width, height, format, BO_USE_NONE,
+		ret = drv->backend->bo_compute_metadata(bo, width, height, format, use_flags,
 							modifiers, count);
 		if (ret == 0)
 			ret = drv->backend->bo_create_from_metadata(bo);
@@ -351,6 +507,8 @@ struct bo *drv_bo_create_with_modifiers(struct driver *drv, uint32_t width, uint
 		ret = drv->backend->bo_create_with_modifiers(bo, width, height, format, modifiers,
 							     count);
 	}
+	drv_stats_end(DRV_STAT_BO_CREATE, start, ret);
+	DRV_TRACE_END();
 
 	if (ret) {
 		free(bo);
@@ -368,6 +526,8 @@ struct bo *drv_bo_create_with_modifiers(struct driver *drv, uint32_t width, uint
 
 	pthread_mutex_unlock(&drv->driver_lock);
 
+	drv_mem_account(bo, true);
+
 	return bo;
 }
 
@@ -379,6 +539,21 @@ void drv_bo_destroy(struct bo *bo)
 	struct driver *drv = bo->drv;
 
 	if (!bo->is_test_buffer) {
+		/* Queued flushes still point at this bo. */
+		drv_async_wait(bo);
+
+		if (bo->slab) {
+			DRV_TRACE_BEGIN("drv_slab_bo_destroy handle=%u", bo->handles[0].u32);
+			drv_slab_bo_destroy(bo);
+			DRV_TRACE_END();
+			free(bo);
+			return;
+		}
+
+		/* Other importers of the same buffer still use this bo. */
+		if (bo->import_refs && !drv_import_cache_put(bo))
+			return;
+
 		pthread_mutex_lock(&drv->driver_lock);
 
 		for (plane = 0; plane < bo->meta.num_planes; plane++)
@@ -390,10 +565,16 @@ void drv_bo_destroy(struct bo *bo)
 		pthread_mutex_unlock(&drv->driver_lock);
 
 		if (total == 0) {
+			DRV_TRACE_BEGIN("drv_bo_destroy handle=%u", bo->handles[0].u32);
+			drv_mem_account(bo, false);
 			ret = drv_mapping_destroy(bo);
 			assert(ret == 0);
 			bo->drv->backend->bo_destroy(bo);
+			DRV_TRACE_END();
 		}
+
+		if (drv->backend->bo_release)
+			drv->backend->bo_release(bo);
 	}
 
 	free(bo);
@@ -405,13 +586,30 @@ struct bo *drv_bo_import(struct driver *drv, struct drv_import_fd_data *data)
 	size_t plane;
 	struct bo *bo;
 	off_t seek_end;
+	uint64_t start;
+	bool first_ref = false;
+	struct drv_import_key key;
+	bool cacheable;
+
+	cacheable = drv_import_key_init(drv, data, &key);
+	if (cacheable) {
+		bo = drv_import_cache_get(drv, &key);
+		if (bo)
+			return bo;
+	}
 
 	bo = drv_bo_new(drv, data->width, data->height, data->format, data->use_flags, false);
 
 	if (!bo)
 		return NULL;
 
+	DRV_TRACE_BEGIN("drv_bo_import " DRV_TRACE_FOURCC " %ux%u use=0x%llx",
+			DRV_TRACE_FOURCC_ARGS(data->format), data->width, data->height,
+			(unsigned long long)data->use_flags);
+	start = drv_stats_begin();
 	ret = drv->backend->bo_import(bo, data);
+	drv_stats_end(DRV_STAT_BO_IMPORT, start, ret);
+	DRV_TRACE_END();
 	if (ret) {
 		free(bo);
 		return NULL;
@@ -419,6 +617,8 @@ struct bo *drv_bo_import(struct driver *drv, struct drv_import_fd_data *data)
 
 	for (plane = 0; plane < bo->meta.num_planes; plane++) {
 		pthread_mutex_lock(&bo->drv->driver_lock);
+		if (plane == 0)
+			first_ref = !drv_get_reference_count(bo->drv, bo, 0);
 		drv_increment_reference_count(bo->drv, bo, plane);
 		pthread_mutex_unlock(&bo->drv->driver_lock);
 	}
@@ -448,19 +648,130 @@ struct bo *drv_bo_import(struct driver *drv, struct drv_import_fd_data *data)
 		bo->meta.total_size += bo->meta.sizes[plane];
 	}
 
+	if (first_ref)
+		drv_mem_account(bo, true);
+
+	if (cacheable)
+		return drv_import_cache_add(drv, &key, bo);
+
 	return bo;
 
 destroy_bo:
+	/* Balances the removal drv_bo_destroy() does for the last reference. */
+	if (first_ref)
+		drv_mem_account(bo, true);
 	drv_bo_destroy(bo);
 	return NULL;
 }
 
+struct bo *drv_bo_create_from_userptr(struct driver *drv, void *ptr, int memfd, uint64_t offset,
+				      uint32_t width, uint32_t height, uint32_t format,
+				      uint32_t stride, uint64_t use_flags)
+{
+	struct drv_import_fd_data data;
+	uint32_t page_size = getpagesize();
+	size_t plane;
+	struct bo *bo;
+	struct stat st;
+	uint64_t start;
+	int ret, fd;
+
+	if ((uintptr_t)ptr % page_size || offset % page_size || (!ptr && memfd < 0) ||
+	    stride < drv_stride_from_format(format, width, 0)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	bo = drv_bo_new(drv, width, height, format, use_flags, false);
+	if (!bo)
+		return NULL;
+
+	drv_bo_from_format(bo, stride, height, format);
+	for (plane = 0; plane < bo->meta.num_planes; plane++)
+		bo->meta.format_modifiers[plane] = DRM_FORMAT_MOD_LINEAR;
+
+	/* The planes themselves must lie within the memfd; only the last page may be short. */
+	if (memfd >= 0 && (fstat(memfd, &st) || offset + bo->meta.total_size > (uint64_t)st.st_size)) {
+		free(bo);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	bo->meta.total_size = ALIGN(bo->meta.total_size, page_size);
+
+	if (memfd < 0) {
+		if (!drv->backend->bo_create_from_userptr) {
+			free(bo);
+			errno = ENOTSUP;
+			return NULL;
+		}
+
+		start = drv_stats_begin();
+		ret = drv->backend->bo_create_from_userptr(bo, ptr);
+		drv_stats_end(DRV_STAT_BO_CREATE, start, ret);
+		if (ret) {
+			free(bo);
+			errno = -ret;
+			return NULL;
+		}
+
+		pthread_mutex_lock(&drv->driver_lock);
+		for (plane = 0; plane < bo->meta.num_planes; plane++)
+			drv_increment_reference_count(drv, bo, plane);
+		pthread_mutex_unlock(&drv->driver_lock);
+
+		drv_mem_account(bo, true);
+		return bo;
+	}
+
+	/*
+	 * Without udmabuf only the software backend, whose handles are plain memfds, can take
+	 * the memfd itself. Other backends would try to PRIME import it and fail obscurely.
+	 */
+	fd = drv_udmabuf_create(memfd, offset, bo->meta.total_size);
+	if (fd == -ENOENT) {
+		if (drv->backend != &backend_sw)
+			fd = -ENOTSUP;
+		else if (offset + bo->meta.total_size > UINT32_MAX)
+			fd = -EOVERFLOW;
+	}
+
+	if (fd < 0 && fd != -ENOENT) {
+		free(bo);
+		errno = -fd;
+		return NULL;
+	}
+
+	memset(&data, 0, sizeof(data));
+	data.width = width;
+	data.height = height;
+	data.format = format;
+	data.use_flags = use_flags;
+	for (plane = 0; plane < bo->meta.num_planes; plane++) {
+		data.fds[plane] = fd >= 0 ? fd : memfd;
+		data.strides[plane] = bo->meta.strides[plane];
+		data.offsets[plane] = bo->meta.offsets[plane] + (fd >= 0 ? 0 : offset);
+		data.format_modifiers[plane] = DRM_FORMAT_MOD_LINEAR;
+	}
+
+	free(bo);
+	bo = drv_bo_import(drv, &data);
+
+	if (fd >= 0)
+		close(fd);
+
+	return bo;
+}
+
 void *drv_bo_map(struct bo *bo, const struct rectangle *rect, uint32_t map_flags,
 		 struct mapping **map_data, size_t plane)
 {
 	uint32_t i;
 	uint8_t *addr;
 	struct mapping mapping;
+	uint32_t discard;
+	uint64_t start;
+	size_t end;
 
 	assert(rect->width >= 0);
 	assert(rect->height >= 0);
@@ -474,16 +785,36 @@ void *drv_bo_map(struct bo *bo, const struct rectangle *rect, uint32_t map_flags
 		return MAP_FAILED;
 	}
 
+	drv_async_wait(bo);
+
+	/* Discard only affects the invalidate, so discarding maps share vmas with plain ones. */
+	discard = map_flags & BO_MAP_DISCARD;
+	map_flags &= ~BO_MAP_DISCARD;
+
+	if (map_flags & BO_MAP_NONBLOCK) {
+		map_flags &= ~BO_MAP_NONBLOCK;
+		if (drv_bo_busy(bo, map_flags) > 0) {
+			*map_data = NULL;
+			errno = EBUSY;
+			return MAP_FAILED;
+		}
+	}
+
 	memset(&mapping, 0, sizeof(mapping));
 	mapping.rect = *rect;
 	mapping.refcount = 1;
 
+	/* Buffers sharing an object, like slab buffers, may end past an earlier, shorter vma. */
+	end = drv_bo_get_plane_offset(bo, plane) + drv_bo_get_plane_size(bo, plane);
+
 	pthread_mutex_lock(&bo->drv->driver_lock);
 
+	drv_map_policy_record(bo, rect, map_flags, plane);
+
 	for (i = 0; i < drv_array_size(bo->drv->mappings); i++) {
 		struct mapping *prior = (struct mapping *)drv_array_at_idx(bo->drv->mappings, i);
 		if (prior->vma->handle != bo->handles[plane].u32 ||
-		    prior->vma->map_flags != map_flags)
+		    prior->vma->map_flags != map_flags || prior->vma->length < end)
 			continue;
 
 		if (rect->x != prior->rect.x || rect->y != prior->rect.y ||
@@ -498,7 +829,7 @@ void *drv_bo_map(struct bo *bo, const struct rectangle *rect, uint32_t map_flags
 	for (i = 0; i < drv_array_size(bo->drv->mappings); i++) {
 		struct mapping *prior = (struct mapping *)drv_array_at_idx(bo->drv->mappings, i);
 		if (prior->vma->handle != bo->handles[plane].u32 ||
-		    prior->vma->map_flags != map_flags)
+		    prior->vma->map_flags != map_flags || prior->vma->length < end)
 			continue;
 
 		prior->vma->refcount++;
@@ -508,7 +839,20 @@ void *drv_bo_map(struct bo *bo, const struct rectangle *rect, uint32_t map_flags
 
 	mapping.vma = calloc(1, sizeof(*mapping.vma));
 	memcpy(mapping.vma->map_strides, bo->meta.strides, sizeof(mapping.vma->map_strides));
-	addr = bo->drv->backend->bo_map(bo, mapping.vma, plane, map_flags);
+	mapping.vma->map_flags = map_flags;
+	mapping.vma->map_cache = drv_map_policy_select(bo);
+	DRV_TRACE_BEGIN("drv_bo_map handle=%u plane=%zu flags=0x%x", bo->handles[plane].u32, plane,
+			map_flags);
+	start = drv_stats_begin();
+	/* Slab buffers share one vma per backing object, so it has to cover all of it. */
+	if (bo->slab)
+		addr = bo->drv->backend->bo_map(bo->slab->bo, mapping.vma, 0, map_flags);
+	else
+		addr = bo->drv->backend->bo_map(bo, mapping.vma, plane, map_flags);
+	if (addr != MAP_FAILED && drv_map_policy_populate(bo, map_flags))
+		drv_populate_mapping(addr, mapping.vma->length, map_flags);
+	drv_stats_end(DRV_STAT_BO_MAP, start, (addr == MAP_FAILED) ? -EFAULT : 0);
+	DRV_TRACE_END();
 	if (addr == MAP_FAILED) {
 		*map_data = NULL;
 		free(mapping.vma);
@@ -524,7 +868,7 @@ void *drv_bo_map(struct bo *bo, const struct rectangle *rect, uint32_t map_flags
 success:
 	*map_data = drv_array_append(bo->drv->mappings, &mapping);
 exact_match:
-	drv_bo_invalidate(bo, *map_data);
+	drv_bo_invalidate_flags(bo, *map_data, map_flags | discard);
 	addr = (uint8_t *)((*map_data)->vma->addr);
 	addr += drv_bo_get_plane_offset(bo, plane);
 	pthread_mutex_unlock(&bo->drv->driver_lock);
@@ -536,13 +880,21 @@ int drv_bo_unmap(struct bo *bo, struct mapping *mapping)
 	uint32_t i;
 	int ret = 0;
 
+	drv_async_wait(bo);
+
 	pthread_mutex_lock(&bo->drv->driver_lock);
 
 	if (--mapping->refcount)
 		goto out;
 
 	if (!--mapping->vma->refcount) {
-		ret = bo->drv->backend->bo_unmap(bo, mapping->vma);
+		uint64_t start;
+
+		DRV_TRACE_BEGIN("drv_bo_unmap handle=%u", mapping->vma->handle);
+		start = drv_stats_begin();
+		ret = bo->drv->backend->bo_unmap(drv_slab_backing(bo), mapping->vma);
+		drv_stats_end(DRV_STAT_BO_UNMAP, start, ret);
+		DRV_TRACE_END();
 		free(mapping->vma);
 	}
 
@@ -559,6 +911,14 @@ out:
 }
 
 int drv_bo_invalidate(struct bo *bo, struct mapping *mapping)
+{
+	assert(mapping);
+	assert(mapping->vma);
+
+	return drv_bo_invalidate_flags(bo, mapping, mapping->vma->map_flags);
+}
+
+int drv_bo_invalidate_flags(struct bo *bo, struct mapping *mapping, uint32_t map_flags)
 {
 	int ret = 0;
 
@@ -567,12 +927,61 @@ int drv_bo_invalidate(struct bo *bo, struct mapping *mapping)
 	assert(mapping->refcount > 0);
 	assert(mapping->vma->refcount > 0);
 
-	if (bo->drv->backend->bo_invalidate)
+	drv_async_wait(bo);
+
+	if (map_flags & BO_MAP_READ)
+		map_flags &= ~BO_MAP_DISCARD;
+	mapping->access_flags = map_flags;
+
+	if (bo->drv->backend->bo_invalidate) {
+		uint64_t start;
+
+		DRV_TRACE_BEGIN("drv_bo_invalidate handle=%u", mapping->vma->handle);
+		start = drv_stats_begin();
 		ret = bo->drv->backend->bo_invalidate(bo, mapping);
+		drv_stats_end(DRV_STAT_BO_INVALIDATE, start, ret);
+		DRV_TRACE_END();
+	}
 
 	return ret;
 }
 
+int drv_bo_busy(struct bo *bo, uint32_t map_flags)
+{
+	if (!bo->drv->backend->bo_busy)
+		return 0;
+
+	return bo->drv->backend->bo_busy(bo, map_flags);
+}
+
+int drv_bo_set_purgeable(struct bo *bo)
+{
+	int ret;
+
+	if (bo->is_test_buffer)
+		return -EINVAL;
+
+	/* Slab buffers share their object with neighbours that are still in use. */
+	if (bo->slab || !bo->drv->backend->bo_madvise)
+		return 0;
+
+	drv_async_wait(bo);
+
+	ret = bo->drv->backend->bo_madvise(bo, true);
+	return (ret < 0) ? ret : 0;
+}
+
+int drv_bo_reclaim(struct bo *bo)
+{
+	if (bo->is_test_buffer)
+		return -EINVAL;
+
+	if (bo->slab || !bo->drv->backend->bo_madvise)
+		return 0;
+
+	return bo->drv->backend->bo_madvise(bo, false);
+}
+
 int drv_bo_flush(struct bo *bo, struct mapping *mapping)
 {
 	int ret = 0;
@@ -582,8 +991,15 @@ int drv_bo_flush(struct bo *bo, struct mapping *mapping)
 	assert(mapping->refcount > 0);
 	assert(mapping->vma->refcount > 0);
 
-	if (bo->drv->backend->bo_flush)
+	if (bo->drv->backend->bo_flush) {
+		uint64_t start;
+
+		DRV_TRACE_BEGIN("drv_bo_flush handle=%u", mapping->vma->handle);
+		start = drv_stats_begin();
 		ret = bo->drv->backend->bo_flush(bo, mapping);
+		drv_stats_end(DRV_STAT_BO_FLUSH, start, ret);
+		DRV_TRACE_END();
+	}
 
 	return ret;
 }
@@ -598,8 +1014,10 @@ int drv_bo_flush_or_unmap(struct bo *bo, struct mapping *mapping)
 	assert(mapping->vma->refcount > 0);
 	assert(!(bo->meta.use_flags & BO_USE_PROTECTED));
 
+	drv_async_wait(bo);
+
 	if (bo->drv->backend->bo_flush)
-		ret = bo->drv->backend->bo_flush(bo, mapping);
+		ret = drv_bo_flush(bo, mapping);
 	else
 		ret = drv_bo_unmap(bo, mapping);
 
@@ -640,6 +1058,15 @@ int drv_bo_get_plane_fd(struct bo *bo, size_t plane)
 		return -EINVAL;
 	}
 
+	/* A slab buffer is exported as its whole backing object, with offsets into it. */
+	if (bo->slab) {
+		bo = bo->slab->bo;
+		plane = 0;
+	}
+
+	if (bo->drv->backend->bo_get_plane_fd)
+		return bo->drv->backend->bo_get_plane_fd(bo, plane);
+
 	ret = drmPrimeHandleToFD(bo->drv->fd, bo->handles[plane].u32, DRM_CLOEXEC | DRM_RDWR, &fd);
 
 	// Older DRM implementations blocked DRM_RDWR, but gave a read/write mapping anyways
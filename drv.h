@@ -48,6 +48,13 @@ extern "C" {
 #define BO_MAP_READ (1 << 0)
 #define BO_MAP_WRITE (1 << 1)
 #define BO_MAP_READ_WRITE (BO_MAP_READ | BO_MAP_WRITE)
+/* Fail with EBUSY instead of waiting when the GPU still has work pending on the buffer. */
+#define BO_MAP_NONBLOCK (1 << 2)
+/*
+ * Write-only access that overwrites the whole mapped rectangle: its old contents are not read
+ * back. Ignored when combined with BO_MAP_READ.
+ */
+#define BO_MAP_DISCARD (1 << 3)
 
 /* This is our extension to <drm_fourcc.h>.  We need to make sure we don't step
  * on the namespace of already defined formats, which can be done by using invalid
@@ -92,6 +99,27 @@ struct drv_import_fd_data {
 	uint64_t use_flags;
 };
 
+/* CPU caching of a mapping, as picked by the map policy. */
+enum drv_map_cache {
+	/* The backend decides from the buffer's use flags. */
+	DRV_MAP_CACHE_DEFAULT,
+	/* Cached CPU access: a WB mapping, or a shadow copy where only WC is available. */
+	DRV_MAP_CACHE_CACHED,
+	/* Write-combined access to the buffer itself. */
+	DRV_MAP_CACHE_WC,
+	DRV_MAP_CACHE_COUNT,
+};
+
+/* Whether new mappings are pre-faulted, so that the first CPU access does not fault per page. */
+enum drv_map_populate {
+	/* From MINIGBM_MAP_POPULATE (auto, always or never), auto when unset. */
+	DRV_MAP_POPULATE_DEFAULT,
+	/* Writable mappings of SW_WRITE_OFTEN and CAMERA_WRITE buffers. */
+	DRV_MAP_POPULATE_AUTO,
+	DRV_MAP_POPULATE_ALWAYS,
+	DRV_MAP_POPULATE_NEVER,
+};
+
 struct vma {
 	void *addr;
 	size_t length;
@@ -99,6 +127,10 @@ struct vma {
 	uint32_t map_flags;
 	int32_t refcount;
 	uint32_t map_strides[DRV_MAX_PLANES];
+	/* Set before bo_map; backends must keep to it for the lifetime of the vma. */
+	enum drv_map_cache map_cache;
+	/* Set by bo_map to how the backend really mapped the buffer, e.g. the i915 mmap mode. */
+	uint32_t map_mode;
 	void *priv;
 };
 
@@ -113,8 +145,27 @@ struct mapping {
 	struct vma *vma;
 	struct rectangle rect;
 	uint32_t refcount;
+	/* BO_MAP_* flags of the current access, for bo_invalidate. */
+	uint32_t access_flags;
 };
 
+#define DRV_MAX_RENDER_NODES 16
+
+struct drv_render_node {
+	int fd;
+	/* Kernel driver name, as drmGetVersion() would report it. */
+	char name[32];
+};
+
+/*
+ * Opens every DRM render node, in minor number order, and reports its kernel driver. The
+ * caller owns the returned fds. Results are cached per boot, see probe.c.
+ */
+int drv_find_render_nodes(struct drv_render_node *nodes, uint32_t max);
+
+/* Drops the render node cache so that the next drv_find_render_nodes() probes again. */
+void drv_probe_cache_clear(void);
+
 struct driver *drv_create(int fd);
 
 int drv_init(struct driver * drv, uint32_t grp_type);
@@ -125,8 +176,20 @@ int drv_get_fd(struct driver *drv);
 
 const char *drv_get_name(struct driver *drv);
 
+void drv_set_map_populate(struct driver *drv, enum drv_map_populate populate);
+
 struct combination *drv_get_combination(struct driver *drv, uint32_t format, uint64_t use_flags);
 
+#define DRV_MAX_FORMAT_MODIFIERS 16
+
+/*
+ * Fills modifiers with up to max distinct modifiers that can be allocated for format with all
+ * of use_flags, most preferred first. Returns the total number available, which may exceed
+ * max, or a negative errno.
+ */
+int drv_get_format_modifiers(struct driver *drv, uint32_t format, uint64_t use_flags,
+			     uint64_t *modifiers, uint32_t max);
+
 struct bo *drv_bo_new(struct driver *drv, uint32_t width, uint32_t height, uint32_t format,
 		      uint64_t use_flags, bool is_test_buffer);
 
@@ -136,10 +199,33 @@ struct bo *drv_bo_create(struct driver *drv, uint32_t width, uint32_t height, ui
 struct bo *drv_bo_create_with_modifiers(struct driver *drv, uint32_t width, uint32_t height,
 					uint32_t format, const uint64_t *modifiers, uint32_t count);
 
+/* Whether the backend can allocate a requested modifier rather than only its own choice. */
+bool drv_supports_modifiers(struct driver *drv);
+
+/* Like drv_bo_create_with_modifiers(), for a buffer that is also used as use_flags says. */
+struct bo *drv_bo_create_with_modifiers_and_use_flags(struct driver *drv, uint32_t width,
+						      uint32_t height, uint32_t format,
+						      uint64_t use_flags, const uint64_t *modifiers,
+						      uint32_t count);
+
 void drv_bo_destroy(struct bo *bo);
 
 struct bo *drv_bo_import(struct driver *drv, struct drv_import_fd_data *data);
 
+/*
+ * Wraps caller memory in a linear buffer without copying it. The memory holds the planes of
+ * format packed after each other with the given plane 0 stride, must be page aligned and
+ * cover the layout rounded up to a page, and must outlive the buffer. Memory in a memfd is
+ * passed as memfd and the offset of the planes in it (ptr may then be NULL) and becomes a
+ * dma-buf through udmabuf, which any backend can import and export; without udmabuf only
+ * the software backend takes the memfd as is, others fail with ENOTSUP. A layout that does
+ * not fit the memfd fails with EINVAL. Other memory is passed as ptr with memfd -1 and needs
+ * a backend with userptr support.
+ */
+struct bo *drv_bo_create_from_userptr(struct driver *drv, void *ptr, int memfd, uint64_t offset,
+				      uint32_t width, uint32_t height, uint32_t format,
+				      uint32_t stride, uint64_t use_flags);
+
 void *drv_bo_map(struct bo *bo, const struct rectangle *rect, uint32_t map_flags,
 		 struct mapping **map_data, size_t plane);
 
@@ -147,10 +233,34 @@ int drv_bo_unmap(struct bo *bo, struct mapping *mapping);
 
 int drv_bo_invalidate(struct bo *bo, struct mapping *mapping);
 
+/* Like drv_bo_invalidate(), for an access with the given BO_MAP_* flags. */
+int drv_bo_invalidate_flags(struct bo *bo, struct mapping *mapping, uint32_t map_flags);
+
+/* Returns > 0 if CPU access with map_flags would have to wait for the GPU, 0 if not. */
+int drv_bo_busy(struct bo *bo, uint32_t map_flags);
+
+/*
+ * For idle buffers kept in caches and pools: the memory of a purgeable buffer may be dropped
+ * under memory pressure. It must not be mapped or used until drv_bo_reclaim(), which returns
+ * 0 if the contents survived and 1 if they were purged, in which case the buffer can only be
+ * destroyed. Backends without support keep the memory and always report it intact.
+ */
+int drv_bo_set_purgeable(struct bo *bo);
+int drv_bo_reclaim(struct bo *bo);
+
 int drv_bo_flush(struct bo *bo, struct mapping *mapping);
 
 int drv_bo_flush_or_unmap(struct bo *bo, struct mapping *mapping);
 
+/*
+ * Like drv_bo_flush() and drv_bo_flush_or_unmap(), but don't wait for the flush. On success
+ * *release_fence is a sync_file that signals once the flushed contents are visible to other
+ * users of the buffer, or -1 if they already are. Later CPU access to the buffer through
+ * minigbm waits for the flush by itself.
+ */
+int drv_bo_flush_async(struct bo *bo, struct mapping *mapping, int *release_fence);
+int drv_bo_flush_or_unmap_async(struct bo *bo, struct mapping *mapping, int *release_fence);
+
 uint32_t drv_bo_get_width(struct bo *bo);
 
 uint32_t drv_bo_get_height(struct bo *bo);
@@ -186,6 +296,43 @@ uint32_t drv_num_buffers_per_bo(struct bo *bo);
 int drv_resource_info(struct bo *bo, uint32_t strides[DRV_MAX_PLANES],
 		      uint32_t offsets[DRV_MAX_PLANES]);
 
+/* Memory held through a driver, for one (format, modifier, use flags) key or in total. */
+struct drv_mem_usage {
+	uint32_t format;
+	uint64_t modifier;
+	uint64_t use_flags;
+	/*
+	 * Backing objects of the small-buffer slabs. Buffers placed in a slab are not counted
+	 * again, so their memory shows up here and not under their own format.
+	 */
+	bool slab;
+	uint64_t count;
+	uint64_t live_bytes;
+	uint64_t peak_bytes;
+	/* Bytes of live_bytes spent on stride, height and size alignment. */
+	uint64_t padding_bytes;
+};
+
+/*
+ * Copies the driver-wide totals into total and up to max per-key entries into usage. Either
+ * pointer may be NULL. Returns the number of per-key entries.
+ */
+int drv_mem_usage_get(struct driver *drv, struct drv_mem_usage *total, struct drv_mem_usage *usage,
+		      uint32_t max);
+
+/* Same contract as drv_stats_dump(), for the memory accounting of drv. */
+int drv_mem_dump(struct driver *drv, char *buf, size_t size);
+
+void drv_stats_set_enabled(bool enabled);
+
+void drv_stats_reset(void);
+
+/*
+ * Writes a report of the per-operation backend statistics into buf, which is always
+ * NUL-terminated when size > 0. Returns the length of the full report, like snprintf().
+ */
+int drv_stats_dump(char *buf, size_t size);
+
 #ifdef USE_GRALLOC1
 uint32_t drv_bo_get_stride_or_tiling(struct bo *bo);
 #endif
@@ -29,11 +29,28 @@ struct bo_metadata {
 	size_t total_size;
 };
 
+/* How the CPU has been mapping a buffer, updated under driver_lock by drv_bo_map(). */
+struct drv_access_profile {
+	uint32_t maps;
+	uint32_t read_maps;
+	uint32_t write_maps;
+	uint64_t read_bytes;
+};
+
 struct bo {
 	struct driver *drv;
 	struct bo_metadata meta;
 	bool is_test_buffer;
+	/* The object that a slab carves small buffers out of, accounted on its own. */
+	bool is_slab_backing;
 	union bo_handle handles[DRV_MAX_PLANES];
+	struct drv_access_profile access;
+	/* Set for small buffers carved out of a shared backing object, see slab.c. */
+	struct drv_slab *slab;
+	/* References held through the import cache, 0 for buffers it does not share. */
+	uint32_t import_refs;
+	/* Flushes queued on the async worker and not yet done, see async.c. */
+	uint32_t async_pending;
 	void *priv;
 };
 
@@ -65,6 +82,11 @@ struct driver {
 	uint32_t gpu_grp_type;  	// enum CIV_GPU_TYPE
 	struct drv_array *mappings;
 	struct drv_array *combos;
+	struct drv_array *slabs;
+	struct drv_array *imports;
+	struct drv_array *mem_usage;
+	struct drv_mem_usage mem_total;
+	enum drv_map_populate map_populate;
 	pthread_mutex_t driver_lock;
 };
 
@@ -82,17 +104,54 @@ struct backend {
 				   uint64_t use_flags, const uint64_t *modifiers, uint32_t count);
 	int (*bo_create_from_metadata)(struct bo *bo);
 	int (*bo_destroy)(struct bo *bo);
+	// Optional. Frees the per-bo state in bo->priv. Unlike bo_destroy, which only runs once
+	// the last bo sharing the buffer handles goes, this runs for every bo.
+	void (*bo_release)(struct bo *bo);
 	int (*bo_import)(struct bo *bo, struct drv_import_fd_data *data);
+	// Optional. Wraps the caller's memory at ptr, which covers meta.total_size bytes, in a
+	// buffer object that does not copy it. The layout is already filled in.
+	int (*bo_create_from_userptr)(struct bo *bo, void *ptr);
 	void *(*bo_map)(struct bo *bo, struct vma *vma, size_t plane, uint32_t map_flags);
 	int (*bo_unmap)(struct bo *bo, struct vma *vma);
 	int (*bo_invalidate)(struct bo *bo, struct mapping *mapping);
 	int (*bo_flush)(struct bo *bo, struct mapping *mapping);
+	// Optional. Returns > 0 when CPU access with map_flags would wait for the GPU.
+	int (*bo_busy)(struct bo *bo, uint32_t map_flags);
+	// Optional. Starts the flush without waiting for it and returns a sync_file that
+	// signals its completion in *release_fence, or -1 if it already completed.
+	int (*bo_flush_async)(struct bo *bo, struct mapping *mapping, int *release_fence);
+	// Optional. Lets the kernel drop the memory (purgeable) or takes it back; returns 1 if
+	// the contents are gone, 0 if not.
+	int (*bo_madvise)(struct bo *bo, bool purgeable);
+	// Optional, for backends whose handles are not GEM handles that PRIME can export.
+	int (*bo_get_plane_fd)(struct bo *bo, size_t plane);
 	uint32_t (*resolve_format)(struct driver *drv, uint32_t format, uint64_t use_flags);
 	size_t (*num_planes_from_modifier)(struct driver *drv, uint32_t format, uint64_t modifier);
 	int (*resource_info)(struct bo *bo, uint32_t strides[DRV_MAX_PLANES],
 			     uint32_t offsets[DRV_MAX_PLANES]);
+	// Optional. Set when init only fills the combination table and a drv->priv of this
+	// size that holds no pointers; init results are then cached across processes.
+	size_t init_cache_priv_size;
+	// Optional, re-derives state kept outside drv->priv after a cached init.
+	void (*init_cache_restore)(struct driver *drv);
 };
 
+/* Whether a backend for the kernel driver called name is built in. */
+bool drv_is_backend_name(const char *name);
+
+/* Names the kernel driver behind a DRM node, see probe.c. */
+int drv_get_driver_name(int fd, char *name, size_t size);
+
+int drv_init_cache_load(struct driver *drv);
+void drv_init_cache_store(struct driver *drv);
+
+/* Waits until no asynchronous flush of bo is queued or running. */
+void drv_async_wait(struct bo *bo);
+
+/* drv_bo_create() for the backing object of a slab, see slab.c. */
+struct bo *drv_bo_create_slab_backing(struct driver *drv, uint32_t width, uint32_t height,
+				      uint32_t format, uint64_t use_flags);
+
 // clang-format off
 #define BO_USE_RENDER_MASK (BO_USE_LINEAR | BO_USE_PROTECTED | BO_USE_RENDERING | \
 	                   BO_USE_RENDERSCRIPT | BO_USE_SW_READ_OFTEN | BO_USE_SW_WRITE_OFTEN | \
@@ -44,7 +44,26 @@ PUBLIC int gbm_device_is_format_supported(struct gbm_device *gbm, uint32_t forma
 PUBLIC int gbm_device_get_format_modifier_plane_count(struct gbm_device *gbm, uint32_t format,
 						      uint64_t modifier)
 {
-	return 0;
+	uint64_t modifiers[DRV_MAX_FORMAT_MODIFIERS];
+	int i, count;
+
+	count = drv_get_format_modifiers(gbm->drv, format, BO_USE_NONE, modifiers,
+					 ARRAY_SIZE(modifiers));
+	for (i = 0; i < MIN(count, (int)ARRAY_SIZE(modifiers)); i++)
+		if (modifiers[i] == modifier)
+			return drv_num_planes_from_modifier(gbm->drv, format, modifier);
+
+	return -1;
+}
+
+PUBLIC int gbm_device_get_format_modifiers(struct gbm_device *gbm, uint32_t format,
+					   uint32_t usage, uint64_t *modifiers, uint32_t count)
+{
+	if (usage & GBM_BO_USE_CURSOR && usage & GBM_BO_USE_RENDERING)
+		return 0;
+
+	return drv_get_format_modifiers(gbm->drv, format, gbm_convert_usage(usage), modifiers,
+					count);
 }
 
 PUBLIC struct gbm_device *gbm_create_device(int fd)
@@ -80,11 +99,21 @@ PUBLIC void gbm_device_destroy(struct gbm_device *gbm)
 PUBLIC struct gbm_surface *gbm_surface_create(struct gbm_device *gbm, uint32_t width,
 					      uint32_t height, uint32_t format, uint32_t usage)
 {
-	struct gbm_surface *surface = (struct gbm_surface *)malloc(sizeof(*surface));
+	struct gbm_surface *surface;
 
+	if (!gbm_device_is_format_supported(gbm, format, usage))
+		return NULL;
+
+	surface = (struct gbm_surface *)calloc(1, sizeof(*surface));
 	if (!surface)
 		return NULL;
 
+	surface->gbm = gbm;
+	surface->width = width;
+	surface->height = height;
+	surface->format = format;
+	surface->usage = usage;
+
 	return surface;
 }
 
@@ -93,28 +122,135 @@ PUBLIC struct gbm_surface *gbm_surface_create_with_modifiers(struct gbm_device *
 							     const uint64_t *modifiers,
 							     const unsigned int count)
 {
-	if (count != 0 || modifiers != NULL)
+	return gbm_surface_create_with_modifiers2(gbm, width, height, format, modifiers, count, 0);
+}
+
+PUBLIC struct gbm_surface *gbm_surface_create_with_modifiers2(struct gbm_device *gbm,
+							      uint32_t width, uint32_t height,
+							      uint32_t format,
+							      const uint64_t *modifiers,
+							      const unsigned int count, uint32_t flags)
+{
+	struct gbm_surface *surface;
+
+	if (count == 0 && modifiers == NULL)
+		return gbm_surface_create(gbm, width, height, format, flags);
+
+	if (!count || !modifiers)
+		return NULL;
+
+	if (!gbm_device_is_format_supported(gbm, format, flags))
+		return NULL;
+
+	surface = (struct gbm_surface *)calloc(1, sizeof(*surface));
+	if (!surface)
+		return NULL;
+
+	surface->modifiers = (uint64_t *)malloc(count * sizeof(*modifiers));
+	if (!surface->modifiers) {
+		free(surface);
 		return NULL;
+	}
+
+	memcpy(surface->modifiers, modifiers, count * sizeof(*modifiers));
+	surface->count = count;
+	surface->gbm = gbm;
+	surface->width = width;
+	surface->height = height;
+	surface->format = format;
+	surface->usage = flags;
 
-	return gbm_surface_create(gbm, width, height, format, 0);
+	return surface;
+}
+
+struct gbm_bo *gbm_surface_get_back_buffer(struct gbm_surface *surface)
+{
+	struct gbm_surface_buffer *buffer = NULL;
+	size_t i;
+
+	if (surface->back)
+		return surface->back->bo;
+
+	/* Prefer recycling an allocated buffer over filling an empty slot. */
+	for (i = 0; i < GBM_SURFACE_MAX_BUFFERS; i++) {
+		if (surface->buffers[i].bo && surface->buffers[i].state == GBM_SURFACE_BUFFER_FREE) {
+			buffer = &surface->buffers[i];
+			break;
+		}
+	}
+
+	for (i = 0; i < GBM_SURFACE_MAX_BUFFERS && !buffer; i++) {
+		if (surface->buffers[i].bo)
+			continue;
+
+		if (surface->modifiers)
+			surface->buffers[i].bo = gbm_bo_create_with_modifiers2(
+			    surface->gbm, surface->width, surface->height, surface->format,
+			    surface->modifiers, surface->count, surface->usage);
+		else
+			surface->buffers[i].bo =
+			    gbm_bo_create(surface->gbm, surface->width, surface->height,
+					  surface->format, surface->usage);
+
+		if (!surface->buffers[i].bo)
+			return NULL;
+
+		buffer = &surface->buffers[i];
+	}
+
+	if (!buffer)
+		return NULL;
+
+	buffer->state = GBM_SURFACE_BUFFER_BACK;
+	surface->back = buffer;
+	return buffer->bo;
 }
 
 PUBLIC struct gbm_bo *gbm_surface_lock_front_buffer(struct gbm_surface *surface)
 {
-	return NULL;
+	struct gbm_surface_buffer *buffer = surface->back;
+
+	if (!buffer)
+		return NULL;
+
+	buffer->state = GBM_SURFACE_BUFFER_LOCKED;
+	surface->back = NULL;
+	return buffer->bo;
 }
 
 PUBLIC void gbm_surface_release_buffer(struct gbm_surface *surface, struct gbm_bo *bo)
 {
+	size_t i;
+
+	for (i = 0; i < GBM_SURFACE_MAX_BUFFERS; i++) {
+		if (surface->buffers[i].bo == bo &&
+		    surface->buffers[i].state == GBM_SURFACE_BUFFER_LOCKED) {
+			surface->buffers[i].state = GBM_SURFACE_BUFFER_FREE;
+			return;
+		}
+	}
 }
 
 PUBLIC int gbm_surface_has_free_buffers(struct gbm_surface *surface)
 {
+	size_t i;
+
+	for (i = 0; i < GBM_SURFACE_MAX_BUFFERS; i++)
+		if (!surface->buffers[i].bo || surface->buffers[i].state == GBM_SURFACE_BUFFER_FREE)
+			return 1;
+
 	return 0;
 }
 
 PUBLIC void gbm_surface_destroy(struct gbm_surface *surface)
 {
+	size_t i;
+
+	for (i = 0; i < GBM_SURFACE_MAX_BUFFERS; i++)
+		if (surface->buffers[i].bo)
+			gbm_bo_destroy(surface->buffers[i].bo);
+
+	free(surface->modifiers);
 	free(surface);
 }
 
@@ -166,6 +302,14 @@ PUBLIC struct gbm_bo *gbm_bo_create(struct gbm_device *gbm, uint32_t width, uint
 PUBLIC struct gbm_bo *gbm_bo_create_with_modifiers(struct gbm_device *gbm, uint32_t width,
 						   uint32_t height, uint32_t format,
 						   const uint64_t *modifiers, uint32_t count)
+{
+	return gbm_bo_create_with_modifiers2(gbm, width, height, format, modifiers, count, 0);
+}
+
+PUBLIC struct gbm_bo *gbm_bo_create_with_modifiers2(struct gbm_device *gbm, uint32_t width,
+						    uint32_t height, uint32_t format,
+						    const uint64_t *modifiers,
+						    const unsigned int count, uint32_t flags)
 {
 	struct gbm_bo *bo;
 
@@ -174,7 +318,34 @@ PUBLIC struct gbm_bo *gbm_bo_create_with_modifiers(struct gbm_device *gbm, uint3
 	if (!bo)
 		return NULL;
 
-	bo->bo = drv_bo_create_with_modifiers(gbm->drv, width, height, format, modifiers, count);
+	bo->bo = drv_bo_create_with_modifiers_and_use_flags(gbm->drv, width, height, format,
+							   gbm_convert_usage(flags), modifiers,
+							   count);
+
+	if (!bo->bo) {
+		free(bo);
+		return NULL;
+	}
+
+	return bo;
+}
+
+PUBLIC struct gbm_bo *gbm_bo_create_from_userptr(struct gbm_device *gbm, void *ptr, int memfd,
+						 uint64_t offset, uint32_t width, uint32_t height,
+						 uint32_t format, uint32_t stride, uint32_t usage)
+{
+	struct gbm_bo *bo;
+
+	if (!gbm_device_is_format_supported(gbm, format, usage))
+		return NULL;
+
+	bo = gbm_bo_new(gbm, format);
+
+	if (!bo)
+		return NULL;
+
+	bo->bo = drv_bo_create_from_userptr(gbm->drv, ptr, memfd, offset, width, height, format,
+					    stride, gbm_convert_usage(usage) | BO_USE_LINEAR);
 
 	if (!bo->bo) {
 		free(bo);
@@ -399,6 +570,22 @@ PUBLIC int gbm_bo_get_plane_fd(struct gbm_bo *bo, size_t plane)
 	return drv_bo_get_plane_fd(bo->bo, plane);
 }
 
+PUBLIC int gbm_device_dump_stats(struct gbm_device *gbm, char *buf, size_t size)
+{
+	int len, ret;
+
+	len = drv_stats_dump(buf, size);
+	if (len < 0)
+		return len;
+
+	ret = drv_mem_dump(gbm->drv, buf ? buf + MIN((size_t)len, size) : NULL,
+			   buf ? size - MIN((size_t)len, size) : 0);
+	if (ret < 0)
+		return ret;
+
+	return len + ret;
+}
+
 PUBLIC void *gbm_bo_map(struct gbm_bo *bo, uint32_t x, uint32_t y, uint32_t width, uint32_t height,
 			uint32_t transfer_flags, uint32_t *stride, void **map_data, size_t plane)
 {
@@ -418,6 +605,8 @@ PUBLIC void *gbm_bo_map2(struct gbm_bo *bo, uint32_t x, uint32_t y, uint32_t wid
 
 	map_flags = (transfer_flags & GBM_BO_TRANSFER_READ) ? BO_MAP_READ : BO_MAP_NONE;
 	map_flags |= (transfer_flags & GBM_BO_TRANSFER_WRITE) ? BO_MAP_WRITE : BO_MAP_NONE;
+	map_flags |= (transfer_flags & GBM_BO_TRANSFER_NONBLOCK) ? BO_MAP_NONBLOCK : BO_MAP_NONE;
+	map_flags |= (transfer_flags & GBM_BO_TRANSFER_DISCARD) ? BO_MAP_DISCARD : BO_MAP_NONE;
 
 	addr = drv_bo_map(bo->bo, &rect, map_flags, (struct mapping **)map_data, plane);
 	if (addr == MAP_FAILED)
@@ -314,6 +314,14 @@ gbm_bo_create_with_modifiers(struct gbm_device *gbm,
                              uint32_t format,
                              const uint64_t *modifiers,
                              const unsigned int count);
+
+struct gbm_bo *
+gbm_bo_create_with_modifiers2(struct gbm_device *gbm,
+                              uint32_t width, uint32_t height,
+                              uint32_t format,
+                              const uint64_t *modifiers,
+                              const unsigned int count,
+                              uint32_t flags);
 #define GBM_BO_IMPORT_WL_BUFFER         0x5501
 #define GBM_BO_IMPORT_EGL_IMAGE         0x5502
 #define GBM_BO_IMPORT_FD                0x5503
@@ -346,6 +354,18 @@ struct gbm_bo *
 gbm_bo_import(struct gbm_device *gbm, uint32_t type,
               void *buffer, uint32_t usage);
 
+/*
+ * Wraps page-aligned CPU memory holding a linear image of format in a buffer without copying
+ * it. The memory must outlive the buffer. Pass memory that lives in a memfd as memfd and the
+ * image's offset in it (ptr may be NULL); such buffers can be exported like any other, but
+ * need udmabuf on GPU drivers. Other memory is passed as ptr with memfd -1 and is only
+ * supported by some drivers.
+ */
+struct gbm_bo *
+gbm_bo_create_from_userptr(struct gbm_device *gbm, void *ptr, int memfd, uint64_t offset,
+                           uint32_t width, uint32_t height, uint32_t format,
+                           uint32_t stride, uint32_t usage);
+
 /**
  * Flags to indicate the type of mapping for the buffer - these are
  * passed into gbm_bo_map(). The caller must set the union of all the
@@ -371,6 +391,16 @@ enum gbm_bo_transfer_flags {
     * Read/modify/write
     */
    GBM_BO_TRANSFER_READ_WRITE = (GBM_BO_TRANSFER_READ | GBM_BO_TRANSFER_WRITE),
+   /**
+    * minigbm extension: fail with errno set to EBUSY instead of waiting
+    * while the GPU still uses the buffer.
+    */
+   GBM_BO_TRANSFER_NONBLOCK   = (1 << 16),
+   /**
+    * minigbm extension: write-only access that overwrites the whole
+    * mapped region, so its old contents are not read back.
+    */
+   GBM_BO_TRANSFER_DISCARD    = (1 << 17),
 };
 
 void
@@ -440,6 +470,14 @@ gbm_surface_create_with_modifiers(struct gbm_device *gbm,
                                   const uint64_t *modifiers,
                                   const unsigned int count);
 
+struct gbm_surface *
+gbm_surface_create_with_modifiers2(struct gbm_device *gbm,
+                                   uint32_t width, uint32_t height,
+                                   uint32_t format,
+                                   const uint64_t *modifiers,
+                                   const unsigned int count,
+                                   uint32_t flags);
+
 struct gbm_bo *
 gbm_surface_lock_front_buffer(struct gbm_surface *surface);
 
@@ -479,6 +517,24 @@ gbm_bo_map2(struct gbm_bo *bo,
 	   uint32_t x, uint32_t y, uint32_t width, uint32_t height,
 	   uint32_t flags, uint32_t *stride, void **map_data, int plane);
 
+/*
+ * Lists the modifiers gbm_bo_create_with_modifiers() can use for format when the buffer is
+ * also given every flag in usage (0 matches any usage), most preferred first. At most count
+ * entries are written to modifiers, which may be NULL to just query the number. Returns the
+ * total number of supported modifiers or a negative errno.
+ */
+int
+gbm_device_get_format_modifiers(struct gbm_device *gbm, uint32_t format, uint32_t usage,
+                                uint64_t *modifiers, uint32_t count);
+
+/*
+ * Writes a text report of minigbm's per-operation timing statistics (enabled with
+ * MINIGBM_STATS=1) and of the memory held through this device into buf. Returns the length
+ * of the full report, like snprintf().
+ */
+int
+gbm_device_dump_stats(struct gbm_device *gbm, char *buf, size_t size);
+
 #ifdef __cplusplus
 }
 #endif
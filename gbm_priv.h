@@ -18,7 +18,31 @@ struct gbm_device {
 	struct driver *drv;
 };
 
+/* Depth of the swap chain: enough for triple buffering plus one buffer being rendered. */
+#define GBM_SURFACE_MAX_BUFFERS 4
+
+enum gbm_surface_buffer_state {
+	GBM_SURFACE_BUFFER_FREE,
+	GBM_SURFACE_BUFFER_BACK,
+	GBM_SURFACE_BUFFER_LOCKED,
+};
+
+struct gbm_surface_buffer {
+	struct gbm_bo *bo;
+	enum gbm_surface_buffer_state state;
+};
+
 struct gbm_surface {
+	struct gbm_device *gbm;
+	uint32_t width;
+	uint32_t height;
+	uint32_t format;
+	uint32_t usage;
+	uint64_t *modifiers;
+	uint32_t count;
+	/* Slots are allocated on first use and reused until the surface is destroyed. */
+	struct gbm_surface_buffer buffers[GBM_SURFACE_MAX_BUFFERS];
+	struct gbm_surface_buffer *back;
 };
 
 struct gbm_bo {
@@ -29,4 +53,12 @@ struct gbm_bo {
 	void (*destroy_user_data)(struct gbm_bo *, void *);
 };
 
+/*
+ * Returns the buffer to render the next frame of the surface into, or NULL when every buffer
+ * is still locked. This stands in for the EGL platform code that picks the back buffer in
+ * Mesa's gbm and is not exported. The same buffer is returned until
+ * gbm_surface_lock_front_buffer() turns it into the front buffer.
+ */
+struct gbm_bo *gbm_surface_get_back_buffer(struct gbm_surface *surface);
+
 #endif
@@ -6,18 +6,38 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/dma-buf.h>
+#include <linux/udmabuf.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <xf86drm.h>
 
 #include "drv_priv.h"
 #include "helpers.h"
+#include "stats.h"
 #include "util.h"
 
+#ifndef DMA_BUF_IOCTL_EXPORT_SYNC_FILE
+struct dma_buf_export_sync_file {
+	__u32 flags;
+	__s32 fd;
+};
+#define DMA_BUF_IOCTL_EXPORT_SYNC_FILE _IOWR(DMA_BUF_BASE, 2, struct dma_buf_export_sync_file)
+#endif
+
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ 22
+#define MADV_POPULATE_WRITE 23
+#endif
+
 #ifdef USE_GRALLOC1
 #include "i915_private.h"
 #endif
@@ -516,7 +536,9 @@ int drv_mapping_destroy(struct bo *bo)
 			}
 
 			if (!--mapping->vma->refcount) {
+				uint64_t start = drv_stats_begin();
 				ret = bo->drv->backend->bo_unmap(bo, mapping->vma);
+				drv_stats_end(DRV_STAT_BO_UNMAP, start, ret);
 				if (ret) {
 					drv_log("munmap failed\n");
 					return ret;
@@ -538,6 +560,171 @@ int drv_get_prot(uint32_t map_flags)
 	return (BO_MAP_WRITE & map_flags) ? PROT_WRITE | PROT_READ : PROT_READ;
 }
 
+/*
+ * Returns a sync_file with the fences of the dma-buf that an access of the given kind
+ * (DMA_BUF_SYNC_READ and/or DMA_BUF_SYNC_WRITE) would have to wait for. Needs Linux 6.0.
+ */
+int drv_dmabuf_export_sync_file(int dmabuf_fd, uint32_t flags)
+{
+	struct dma_buf_export_sync_file export;
+
+	memset(&export, 0, sizeof(export));
+	export.flags = flags;
+
+	if (drmIoctl(dmabuf_fd, DMA_BUF_IOCTL_EXPORT_SYNC_FILE, &export))
+		return -errno;
+
+	return export.fd;
+}
+
+/*
+ * Brackets CPU access to a dma-buf: sync_flags is DMA_BUF_SYNC_START or DMA_BUF_SYNC_END, the
+ * direction comes from the BO_MAP_* flags of the mapping. The kernel has no ranged variant, so
+ * this always covers the whole buffer. Fds that are not dma-bufs (plain memfds) need no sync.
+ */
+int drv_dmabuf_sync(int dmabuf_fd, uint64_t sync_flags, uint32_t map_flags)
+{
+	struct dma_buf_sync sync;
+
+	memset(&sync, 0, sizeof(sync));
+	sync.flags = sync_flags;
+	if (map_flags & BO_MAP_READ)
+		sync.flags |= DMA_BUF_SYNC_READ;
+	if (map_flags & BO_MAP_WRITE)
+		sync.flags |= DMA_BUF_SYNC_WRITE;
+
+	if (drmIoctl(dmabuf_fd, DMA_BUF_IOCTL_SYNC, &sync)) {
+		if (errno == ENOTTY)
+			return 0;
+
+		drv_log("DMA_BUF_IOCTL_SYNC failed: %s\n", strerror(errno));
+		return -errno;
+	}
+
+	return 0;
+}
+
+/*
+ * Wraps size bytes of memfd at offset, both page aligned, in a dma-buf. The memfd must be
+ * sealed against shrinking. Returns the dma-buf fd or a negative errno, -ENOENT when the
+ * kernel has no udmabuf.
+ */
+int drv_udmabuf_create(int memfd, uint64_t offset, uint64_t size)
+{
+	struct udmabuf_create create;
+	int dev, fd;
+
+	dev = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+	if (dev < 0)
+		return -errno;
+
+	memset(&create, 0, sizeof(create));
+	create.memfd = memfd;
+	create.flags = UDMABUF_FLAGS_CLOEXEC;
+	create.offset = offset;
+	create.size = size;
+
+	fd = ioctl(dev, UDMABUF_CREATE, &create);
+	if (fd < 0) {
+		fd = -errno;
+		drv_log("UDMABUF_CREATE failed: %s\n", strerror(errno));
+	}
+
+	close(dev);
+	return fd;
+}
+
+/*
+ * Generic map path for backends whose exporter implements dma-buf mmap: the plane is
+ * exported, mapped through the dma-buf fd and kept open in vma->priv for the syncs. Map and
+ * unmap leave the SYNC_START/SYNC_END brackets to invalidate and flush, which drv_bo_map()
+ * and the unlock paths already call, so every START is matched by exactly one END.
+ */
+void *drv_dmabuf_bo_map(struct bo *bo, struct vma *vma, size_t plane, uint32_t map_flags)
+{
+	void *addr;
+	size_t i;
+	int fd;
+
+	fd = drv_bo_get_plane_fd(bo, plane);
+	if (fd < 0) {
+		drv_log("Failed to export plane %zu\n", plane);
+		return MAP_FAILED;
+	}
+
+	for (i = 0; i < bo->meta.num_planes; i++)
+		if (bo->handles[i].u32 == bo->handles[plane].u32)
+			vma->length = MAX(vma->length, bo->meta.offsets[i] + bo->meta.sizes[i]);
+
+	vma->length = ALIGN(vma->length, getpagesize());
+
+	addr = mmap(0, vma->length, drv_get_prot(map_flags), MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED) {
+		drv_log("dma-buf mmap failed: %s\n", strerror(errno));
+		close(fd);
+		return MAP_FAILED;
+	}
+
+	vma->priv = (void *)(intptr_t)fd;
+	return addr;
+}
+
+int drv_dmabuf_bo_unmap(struct bo *bo, struct vma *vma)
+{
+	int fd = (int)(intptr_t)vma->priv;
+
+	close(fd);
+	vma->priv = NULL;
+
+	return munmap(vma->addr, vma->length);
+}
+
+int drv_dmabuf_bo_invalidate(struct bo *bo, struct mapping *mapping)
+{
+	return drv_dmabuf_sync((int)(intptr_t)mapping->vma->priv, DMA_BUF_SYNC_START,
+			       mapping->vma->map_flags);
+}
+
+int drv_dmabuf_bo_flush(struct bo *bo, struct mapping *mapping)
+{
+	return drv_dmabuf_sync((int)(intptr_t)mapping->vma->priv, DMA_BUF_SYNC_END,
+			       mapping->vma->map_flags);
+}
+
+/*
+ * For backends whose buffers can only be mapped WC: whether a mapping should go through a
+ * cached shadow copy that is synced on invalidate and flush.
+ */
+bool drv_map_wants_shadow(struct bo *bo, struct vma *vma)
+{
+	if (vma->map_cache != DRV_MAP_CACHE_DEFAULT)
+		return vma->map_cache == DRV_MAP_CACHE_CACHED;
+
+	return bo->meta.use_flags & BO_USE_RENDERSCRIPT;
+}
+
+/*
+ * Pre-faults a new mapping. MADV_POPULATE_* (Linux 5.14) fails on VM_PFNMAP mappings, but
+ * those are mostly GEM mappings whose fault handler maps the whole object at once anyway.
+ */
+void drv_populate_mapping(void *addr, size_t length, uint32_t map_flags)
+{
+	int advice = (map_flags & BO_MAP_WRITE) ? MADV_POPULATE_WRITE : MADV_POPULATE_READ;
+
+	if (madvise(addr, length, advice))
+		madvise(addr, length, MADV_WILLNEED);
+}
+
+/*
+ * Whether the current access overwrites every byte of the mapping, so that backends keeping a
+ * whole-buffer shadow can skip reading it back.
+ */
+bool drv_mapping_discards_all(struct bo *bo, struct mapping *mapping)
+{
+	return (mapping->access_flags & BO_MAP_DISCARD) && !mapping->rect.x && !mapping->rect.y &&
+	       mapping->rect.width == bo->meta.width && mapping->rect.height == bo->meta.height;
+}
+
 uintptr_t drv_get_reference_count(struct driver *drv, struct bo *bo, size_t plane)
 {
 	void *count;
@@ -651,3 +838,89 @@ bool drv_has_modifier(const uint64_t *list, uint32_t count, uint64_t modifier)
 
 	return false;
 }
+
+/*
+ * Builds the path of a small cache file shared between processes. MINIGBM_CACHE_DIR overrides
+ * the directory, an empty value disables caching. Anybody can plant files in /tmp, so the
+ * fallback there is a directory of our own that nobody else can write to.
+ */
+int drv_cache_path(const char *name, char *path, size_t size)
+{
+	const char *dir = getenv("MINIGBM_CACHE_DIR");
+	char tmp_dir[32];
+	struct stat st;
+	int len;
+
+	if (dir && !dir[0])
+		return -ENOENT;
+
+#ifdef __ANDROID__
+	if (!dir)
+		dir = "/data/vendor/minigbm";
+#endif
+	if (!dir)
+		dir = getenv("XDG_RUNTIME_DIR");
+
+	if (!dir) {
+		snprintf(tmp_dir, sizeof(tmp_dir), "/tmp/minigbm-%u", (unsigned)geteuid());
+		if (mkdir(tmp_dir, 0700) && errno != EEXIST)
+			return -errno;
+
+		if (lstat(tmp_dir, &st))
+			return -errno;
+
+		if (!S_ISDIR(st.st_mode) || st.st_uid != geteuid() ||
+		    (st.st_mode & 0777) != 0700) {
+			drv_log("Not caching in %s, it is not a private directory\n", tmp_dir);
+			return -EPERM;
+		}
+
+		dir = tmp_dir;
+	}
+
+	len = snprintf(path, size, "%s/minigbm-%s", dir, name);
+	return (len < 0 || (size_t)len >= size) ? -ENAMETOOLONG : 0;
+}
+
+int drv_read_boot_id(char *boot_id, size_t size)
+{
+	ssize_t len;
+	int fd;
+
+	memset(boot_id, 0, size);
+	fd = open("/proc/sys/kernel/random/boot_id", O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	len = read(fd, boot_id, size - 1);
+	close(fd);
+
+	return (len > 0) ? 0 : -EIO;
+}
+
+/* Readers never see a partial file: it is written next to path and renamed into place. */
+int drv_write_file_atomic(const char *path, const void *data, size_t size)
+{
+	char tmp[PATH_MAX];
+	ssize_t len;
+	int fd, ret = 0;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid()) >= (int)sizeof(tmp))
+		return -ENAMETOOLONG;
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return -errno;
+
+	len = write(fd, data, size);
+	if (len < 0 || (size_t)len != size)
+		ret = -EIO;
+	close(fd);
+
+	if (!ret && rename(tmp, path))
+		ret = -errno;
+	if (ret)
+		unlink(tmp);
+
+	return ret;
+}
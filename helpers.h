@@ -12,6 +12,14 @@
 #include "drv.h"
 #include "helpers_array.h"
 
+/*
+ * Opts a backend into mapping through its exported dma-bufs, with CPU access bracketed by
+ * DMA_BUF_IOCTL_SYNC. Use in place of the .bo_map/.bo_unmap/.bo_invalidate/.bo_flush hooks.
+ */
+#define DRV_DMABUF_MAP_FUNCS                                                                       \
+	.bo_map = drv_dmabuf_bo_map, .bo_unmap = drv_dmabuf_bo_unmap,                              \
+	.bo_invalidate = drv_dmabuf_bo_invalidate, .bo_flush = drv_dmabuf_bo_flush
+
 uint32_t drv_height_from_format(uint32_t format, uint32_t height, size_t plane);
 uint32_t drv_vertical_subsampling_from_format(uint32_t format, size_t plane);
 uint32_t drv_size_from_format(uint32_t format, uint32_t stride, uint32_t height, size_t plane);
@@ -29,6 +37,16 @@ void *drv_dumb_bo_map(struct bo *bo, struct vma *vma, size_t plane, uint32_t map
 int drv_bo_munmap(struct bo *bo, struct vma *vma);
 int drv_mapping_destroy(struct bo *bo);
 int drv_get_prot(uint32_t map_flags);
+bool drv_map_wants_shadow(struct bo *bo, struct vma *vma);
+bool drv_mapping_discards_all(struct bo *bo, struct mapping *mapping);
+void drv_populate_mapping(void *addr, size_t length, uint32_t map_flags);
+int drv_dmabuf_export_sync_file(int dmabuf_fd, uint32_t flags);
+int drv_dmabuf_sync(int dmabuf_fd, uint64_t sync_flags, uint32_t map_flags);
+int drv_udmabuf_create(int memfd, uint64_t offset, uint64_t size);
+void *drv_dmabuf_bo_map(struct bo *bo, struct vma *vma, size_t plane, uint32_t map_flags);
+int drv_dmabuf_bo_unmap(struct bo *bo, struct vma *vma);
+int drv_dmabuf_bo_invalidate(struct bo *bo, struct mapping *mapping);
+int drv_dmabuf_bo_flush(struct bo *bo, struct mapping *mapping);
 uintptr_t drv_get_reference_count(struct driver *drv, struct bo *bo, size_t plane);
 void drv_increment_reference_count(struct driver *drv, struct bo *bo, size_t plane);
 void drv_decrement_reference_count(struct driver *drv, struct bo *bo, size_t plane);
@@ -42,4 +60,7 @@ int drv_modify_linear_combinations(struct driver *drv);
 uint64_t drv_pick_modifier(const uint64_t *modifiers, uint32_t count,
 			   const uint64_t *modifier_order, uint32_t order_count);
 bool drv_has_modifier(const uint64_t *list, uint32_t count, uint64_t modifier);
+int drv_cache_path(const char *name, char *path, size_t size);
+int drv_read_boot_id(char *boot_id, size_t size);
+int drv_write_file_atomic(const char *path, const void *data, size_t size);
 #endif
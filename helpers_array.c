@@ -31,7 +31,7 @@ struct drv_array *drv_array_init(uint32_t item_size)
 	return array;
 }
 
-void *drv_array_append(struct drv_array *array, void *data)
+void *drv_array_append(struct drv_array *array, const void *data)
 {
 	void *item;
 
@@ -9,7 +9,7 @@ struct drv_array;
 struct drv_array *drv_array_init(uint32_t item_size);
 
 /* The data will be copied and appended to the array. */
-void *drv_array_append(struct drv_array *array, void *data);
+void *drv_array_append(struct drv_array *array, const void *data);
 
 /* The data at the specified index will be freed -- the array will shrink. */
 void drv_array_remove(struct drv_array *array, uint32_t idx);
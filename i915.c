@@ -18,6 +18,7 @@
 
 #include "drv_priv.h"
 #include "helpers.h"
+#include "i915_device_info.h"
 #include "util.h"
 
 #ifdef USE_GRALLOC1
@@ -27,6 +28,14 @@
 #define I915_CACHELINE_SIZE 64
 #define I915_CACHELINE_MASK (I915_CACHELINE_SIZE - 1)
 
+#ifndef I915_MMAP_OFFSET_FIXED
+#define I915_MMAP_OFFSET_FIXED 4
+#endif
+
+#ifndef I915_FORMAT_MOD_4_TILED
+#define I915_FORMAT_MOD_4_TILED fourcc_mod_code(INTEL, 9)
+#endif
+
 static const uint32_t scanout_render_formats[] = { DRM_FORMAT_ABGR2101010, DRM_FORMAT_ABGR8888,
 						   DRM_FORMAT_ARGB2101010, DRM_FORMAT_ARGB8888,
 						   DRM_FORMAT_RGB565,	   DRM_FORMAT_XBGR2101010,
@@ -35,6 +44,11 @@ static const uint32_t scanout_render_formats[] = { DRM_FORMAT_ABGR2101010, DRM_F
 
 static const uint32_t render_formats[] = { DRM_FORMAT_ABGR16161616F };
 
+static const uint32_t ccs_formats[] = { DRM_FORMAT_ABGR2101010, DRM_FORMAT_ABGR8888,
+					DRM_FORMAT_ARGB2101010, DRM_FORMAT_ARGB8888,
+					DRM_FORMAT_XBGR2101010, DRM_FORMAT_XBGR8888,
+					DRM_FORMAT_XRGB2101010, DRM_FORMAT_XRGB8888 };
+
 static const uint32_t texture_only_formats[] = { DRM_FORMAT_R8, DRM_FORMAT_NV12, DRM_FORMAT_P010,
 #ifdef USE_GRALLOC1
 						 DRM_FORMAT_YVU420, DRM_FORMAT_YVU420_ANDROID,
@@ -44,32 +58,32 @@ static const uint32_t texture_only_formats[] = { DRM_FORMAT_R8, DRM_FORMAT_NV12,
 #endif
 
 struct i915_device {
-	uint32_t gen;
+	/* A copy rather than a pointer, so that the init cache can restore it. */
+	struct i915_device_info info;
 	int32_t has_llc;
+	/* DRM_IOCTL_I915_GEM_MMAP_OFFSET is available (I915_PARAM_MMAP_GTT_VERSION >= 4). */
+	bool has_mmap_offset;
+	/*
+	 * The kernel only accepts I915_MMAP_OFFSET_FIXED, as on parts with local memory. Set by
+	 * the first map that finds out, so it is accessed atomically rather than under a lock.
+	 */
+	bool mmap_offset_fixed;
 #ifdef USE_GRALLOC1
 	uint64_t cursor_width;
 	uint64_t cursor_height;
 #endif
 };
 
-static uint32_t i915_get_gen(int device_id)
-{
-	const uint16_t gen3_ids[] = { 0x2582, 0x2592, 0x2772, 0x27A2, 0x27AE,
-				      0x29C2, 0x29B2, 0x29D2, 0xA001, 0xA011 };
-#ifdef USE_GRALLOC1
-	const uint16_t gen12_ids[] = { 0x46A0, 0x46A6, 0x46B3 };
-#endif
-	unsigned i;
-	for (i = 0; i < ARRAY_SIZE(gen3_ids); i++)
-		if (gen3_ids[i] == device_id)
-			return 3;
-#ifdef USE_GRALLOC1
-	for (i = 0; i < ARRAY_SIZE(gen12_ids); i++)
-		if (gen12_ids[i] == device_id)
-			return 12;
-#endif
-	return 4;
-}
+/*
+ * The domain we last moved the buffer to with SET_DOMAIN. Accessed without a lock: a stale
+ * value only costs a redundant SET_DOMAIN.
+ */
+struct i915_bo {
+	uint32_t read_domains;
+	uint32_t write_domain;
+	/* Caller memory behind a userptr object, which cannot be mmapped through GEM. */
+	void *userptr;
+};
 
 static uint64_t unset_flags(uint64_t current_flags, uint64_t mask)
 {
@@ -77,11 +91,25 @@ static uint64_t unset_flags(uint64_t current_flags, uint64_t mask)
 	return value;
 }
 
+/*
+ * Y_TILED_CCS is the gen9-gen11 render compression layout. When the iGPU is an SR-IOV virtual
+ * function shared with virtio-gpu (TWO_GPU_IGPU_VIRTIO and THREE_GPU_IGPU_VIRTIO_DGPU), the
+ * guest cannot rely on the aux surface being preserved, so stay uncompressed there.
+ */
+static bool i915_has_ccs(struct driver *drv)
+{
+	struct i915_device *i915 = drv->priv;
+
+	if (drv->gpu_grp_type == TWO_GPU_IGPU_VIRTIO ||
+	    drv->gpu_grp_type == THREE_GPU_IGPU_VIRTIO_DGPU)
+		return false;
+
+	return i915->info.has_ccs;
+}
+
 static int i915_add_combinations(struct driver *drv)
 {
-#ifdef USE_GRALLOC1
-	struct i915_device *i915;
-#endif
+	struct i915_device *i915 = drv->priv;
 	struct format_metadata metadata;
 	uint64_t render, scanout_and_render, texture_only;
 
@@ -134,14 +162,19 @@ static int i915_add_combinations(struct driver *drv)
 
 	render = unset_flags(render, linear_mask);
 	scanout_and_render = unset_flags(scanout_and_render, linear_mask);
+	// Without fences, the CPU can only see tiled buffers in their tiled layout.
+	if (!i915->info.has_fences) {
+		render = unset_flags(render, BO_USE_SW_READ_RARELY | BO_USE_SW_WRITE_RARELY);
+		scanout_and_render =
+			unset_flags(scanout_and_render, BO_USE_SW_READ_RARELY | BO_USE_SW_WRITE_RARELY);
+	}
 
 	metadata.tiling = I915_TILING_X;
 	metadata.priority = 2;
 	metadata.modifier = I915_FORMAT_MOD_X_TILED;
 
 #ifdef USE_GRALLOC1
-	i915 = drv->priv;
-	if (i915->gen == 12)
+	if (i915->info.gen == 12)
 		scanout_and_render = unset_flags(scanout_and_render, BO_USE_SCANOUT);
 #endif
 	// In sriov mode, MMAP_GTT will fail for tiled buffer.
@@ -152,29 +185,63 @@ static int i915_add_combinations(struct driver *drv)
 	drv_add_combinations(drv, scanout_render_formats, ARRAY_SIZE(scanout_render_formats),
 			     &metadata, scanout_and_render);
 
-	metadata.tiling = I915_TILING_Y;
+	/* The preferred tiled layout: legacy Y, or Tile4 where it replaces Y. */
+	if (i915->info.has_y_tiling) {
+		metadata.tiling = I915_TILING_Y;
+		metadata.modifier = I915_FORMAT_MOD_Y_TILED;
+	} else if (i915->info.has_tile4) {
+		metadata.tiling = I915_TILING_4;
+		metadata.modifier = I915_FORMAT_MOD_4_TILED;
+	} else {
+		metadata.tiling = I915_TILING_NONE;
+	}
 	metadata.priority = 3;
-	metadata.modifier = I915_FORMAT_MOD_Y_TILED;
 
-	scanout_and_render =
-	    unset_flags(scanout_and_render, BO_USE_SW_READ_RARELY | BO_USE_SW_WRITE_RARELY);
+	if (metadata.tiling != I915_TILING_NONE) {
+		scanout_and_render =
+		    unset_flags(scanout_and_render, BO_USE_SW_READ_RARELY | BO_USE_SW_WRITE_RARELY);
 /* Support y-tiled NV12 and P010 for libva */
 #ifdef I915_SCANOUT_Y_TILED
-	drv_add_combination(drv, DRM_FORMAT_NV12, &metadata,
-			    BO_USE_TEXTURE | BO_USE_HW_VIDEO_DECODER | BO_USE_SCANOUT);
+		drv_add_combination(drv, DRM_FORMAT_NV12, &metadata,
+				    BO_USE_TEXTURE | BO_USE_HW_VIDEO_DECODER | BO_USE_SCANOUT);
 #else
-	drv_add_combination(drv, DRM_FORMAT_NV12, &metadata,
-			    BO_USE_TEXTURE | BO_USE_HW_VIDEO_DECODER);
+		drv_add_combination(drv, DRM_FORMAT_NV12, &metadata,
+				    BO_USE_TEXTURE | BO_USE_HW_VIDEO_DECODER);
 #endif
-	scanout_and_render = unset_flags(scanout_and_render, BO_USE_SCANOUT);
-	drv_add_combination(drv, DRM_FORMAT_P010, &metadata,
-			    BO_USE_TEXTURE | BO_USE_HW_VIDEO_DECODER);
+		scanout_and_render = unset_flags(scanout_and_render, BO_USE_SCANOUT);
+		drv_add_combination(drv, DRM_FORMAT_P010, &metadata,
+				    BO_USE_TEXTURE | BO_USE_HW_VIDEO_DECODER);
+
+		drv_add_combinations(drv, render_formats, ARRAY_SIZE(render_formats), &metadata,
+				     render);
+		drv_add_combinations(drv, scanout_render_formats,
+				     ARRAY_SIZE(scanout_render_formats), &metadata,
+				     scanout_and_render);
+	}
+
+	/*
+	 * Compression saves memory bandwidth, but the aux plane is only understood by the GPU.
+	 * Offer it for buffers that are just rendered to and sampled from; anything that also
+	 * needs CPU access or scanout falls back to the Y-tiled combination above.
+	 */
+	if (i915_has_ccs(drv)) {
+		metadata.tiling = I915_TILING_Y;
+		metadata.priority = 4;
+		metadata.modifier = I915_FORMAT_MOD_Y_TILED_CCS;
+
+		drv_add_combinations(drv, ccs_formats, ARRAY_SIZE(ccs_formats), &metadata,
+				     BO_USE_RENDERING | BO_USE_TEXTURE);
+	}
 
-	drv_add_combinations(drv, render_formats, ARRAY_SIZE(render_formats), &metadata, render);
-	drv_add_combinations(drv, scanout_render_formats, ARRAY_SIZE(scanout_render_formats),
-			     &metadata, scanout_and_render);
 #ifdef USE_GRALLOC1
-	i915_private_add_combinations(drv);
+	if (i915->info.has_y_tiling) {
+		metadata.tiling = I915_TILING_Y;
+		metadata.priority = 3;
+		metadata.modifier = I915_FORMAT_MOD_Y_TILED;
+		i915_private_add_combinations(drv, &metadata);
+	} else {
+		i915_private_add_combinations(drv, NULL);
+	}
 #endif
 	return 0;
 }
@@ -183,56 +250,14 @@ static int i915_align_dimensions(struct bo *bo, uint32_t tiling, uint32_t *strid
 				 uint32_t *aligned_height)
 {
 	struct i915_device *i915 = bo->drv->priv;
-	uint32_t horizontal_alignment;
-	uint32_t vertical_alignment;
-
-	switch (tiling) {
-	default:
-	case I915_TILING_NONE:
-		/*
-		 * The Intel GPU doesn't need any alignment in linear mode,
-		 * but libva requires the allocation stride to be aligned to
-		 * 16 bytes and height to 4 rows. Further, we round up the
-		 * horizontal alignment so that row start on a cache line (64
-		 * bytes).
-		 */
-		horizontal_alignment = 64;
-		vertical_alignment = 4;
-		break;
-
-	case I915_TILING_X:
-		horizontal_alignment = 512;
-		vertical_alignment = 8;
-		break;
-
-	case I915_TILING_Y:
-		if (i915->gen == 3) {
-			horizontal_alignment = 512;
-			vertical_alignment = 8;
-		} else {
-			horizontal_alignment = 128;
-			vertical_alignment = 32;
-		}
-		break;
-	}
+	bool align_stride = true;
 
-	*aligned_height = ALIGN(*aligned_height, vertical_alignment);
-	if (i915->gen > 3) {
 #ifdef USE_GRALLOC1
-		if(DRM_FORMAT_R8 != bo->meta.format)
+	if (bo->meta.format == DRM_FORMAT_R8)
+		align_stride = false;
 #endif
-		*stride = ALIGN(*stride, horizontal_alignment);
-	} else {
-		while (*stride > horizontal_alignment)
-			horizontal_alignment <<= 1;
-
-		*stride = horizontal_alignment;
-	}
 
-	if (i915->gen <= 3 && *stride > 8192)
-		return -EINVAL;
-
-	return 0;
+	return i915_device_info_align(&i915->info, tiling, align_stride, stride, aligned_height);
 }
 
 static void i915_clflush(void *start, size_t size)
@@ -251,6 +276,7 @@ static int i915_init(struct driver *drv)
 {
 	int ret;
 	int device_id;
+	int mmap_gtt_version = 0;
 	struct i915_device *i915;
 	drm_i915_getparam_t get_param;
 
@@ -268,18 +294,23 @@ static int i915_init(struct driver *drv)
 		return -EINVAL;
 	}
 
-	i915->gen = i915_get_gen(device_id);
+	i915->info = *i915_get_device_info(device_id);
 
 	memset(&get_param, 0, sizeof(get_param));
 	get_param.param = I915_PARAM_HAS_LLC;
 	get_param.value = &i915->has_llc;
 	ret = drmIoctl(drv->fd, DRM_IOCTL_I915_GETPARAM, &get_param);
 	if (ret) {
-		drv_log("Failed to get I915_PARAM_HAS_LLC\n");
-		free(i915);
-		return -EINVAL;
+		drv_log("Failed to get I915_PARAM_HAS_LLC, assuming %d\n", i915->info.has_llc);
+		i915->has_llc = i915->info.has_llc;
 	}
 
+	memset(&get_param, 0, sizeof(get_param));
+	get_param.param = I915_PARAM_MMAP_GTT_VERSION;
+	get_param.value = &mmap_gtt_version;
+	ret = drmIoctl(drv->fd, DRM_IOCTL_I915_GETPARAM, &get_param);
+	i915->has_mmap_offset = !ret && mmap_gtt_version >= 4;
+
 	drv->priv = i915;
 
 #ifdef USE_GRALLOC1
@@ -322,16 +353,23 @@ static int i915_bo_from_format(struct bo *bo, uint32_t width, uint32_t height, u
 static int i915_bo_compute_metadata(struct bo *bo, uint32_t width, uint32_t height, uint32_t format,
 				    uint64_t use_flags, const uint64_t *modifiers, uint32_t count)
 {
-	static const uint64_t modifier_order[] = {
-		I915_FORMAT_MOD_Y_TILED,
-		I915_FORMAT_MOD_X_TILED,
-		DRM_FORMAT_MOD_LINEAR,
-	};
+	struct i915_device *i915 = bo->drv->priv;
+	uint64_t modifier_order[5];
+	uint32_t num_modifiers = 0;
 	uint64_t modifier;
 
 	if (modifiers) {
-		modifier =
-		    drv_pick_modifier(modifiers, count, modifier_order, ARRAY_SIZE(modifier_order));
+		/* Only offer the layouts the hardware has, best first. */
+		if (i915_has_ccs(bo->drv))
+			modifier_order[num_modifiers++] = I915_FORMAT_MOD_Y_TILED_CCS;
+		if (i915->info.has_y_tiling)
+			modifier_order[num_modifiers++] = I915_FORMAT_MOD_Y_TILED;
+		if (i915->info.has_tile4)
+			modifier_order[num_modifiers++] = I915_FORMAT_MOD_4_TILED;
+		modifier_order[num_modifiers++] = I915_FORMAT_MOD_X_TILED;
+		modifier_order[num_modifiers++] = DRM_FORMAT_MOD_LINEAR;
+
+		modifier = drv_pick_modifier(modifiers, count, modifier_order, num_modifiers);
 	} else {
 		struct combination *combo = drv_get_combination(bo->drv, format, use_flags);
 		if (!combo)
@@ -348,12 +386,23 @@ static int i915_bo_compute_metadata(struct bo *bo, uint32_t width, uint32_t heig
 		break;
 	case I915_FORMAT_MOD_Y_TILED:
 	case I915_FORMAT_MOD_Y_TILED_CCS:
+		if (!i915->info.has_y_tiling)
+			return -EINVAL;
+		bo->meta.tiling = I915_TILING_Y;
+		break;
 #ifdef USE_GRALLOC1
 	case I915_FORMAT_MOD_Yf_TILED:
 	case I915_FORMAT_MOD_Yf_TILED_CCS:
-#endif
+		if (!i915->info.has_yf_tiling)
+			return -EINVAL;
 		bo->meta.tiling = I915_TILING_Y;
 		break;
+#endif
+	case I915_FORMAT_MOD_4_TILED:
+		if (!i915->info.has_tile4)
+			return -EINVAL;
+		bo->meta.tiling = I915_TILING_4;
+		break;
 	}
 
 	bo->meta.format_modifiers[0] = modifier;
@@ -418,6 +467,7 @@ static int i915_bo_compute_metadata(struct bo *bo, uint32_t width, uint32_t heig
 
 static int i915_bo_create_from_metadata(struct bo *bo)
 {
+	struct i915_device *i915 = bo->drv->priv;
 	int ret;
 	size_t plane;
 	struct drm_i915_gem_create gem_create;
@@ -435,6 +485,13 @@ static int i915_bo_create_from_metadata(struct bo *bo)
 	for (plane = 0; plane < bo->meta.num_planes; plane++)
 		bo->handles[plane].u32 = gem_create.handle;
 
+	/* Domain tracking is only an optimization, so running without it is fine. */
+	bo->priv = calloc(1, sizeof(struct i915_bo));
+
+	/* Without fences, the modifier is the only record of the tiling. */
+	if (!i915->info.has_fences)
+		return 0;
+
 	memset(&gem_set_tiling, 0, sizeof(gem_set_tiling));
 	gem_set_tiling.handle = bo->handles[0].u32;
 	gem_set_tiling.tiling_mode = bo->meta.tiling;
@@ -446,6 +503,8 @@ static int i915_bo_create_from_metadata(struct bo *bo)
 		memset(&gem_close, 0, sizeof(gem_close));
 		gem_close.handle = bo->handles[0].u32;
 		drmIoctl(bo->drv->fd, DRM_IOCTL_GEM_CLOSE, &gem_close);
+		free(bo->priv);
+		bo->priv = NULL;
 
 		drv_log("DRM_IOCTL_I915_GEM_SET_TILING failed with %d\n", errno);
 		return -errno;
@@ -454,6 +513,42 @@ static int i915_bo_create_from_metadata(struct bo *bo)
 	return 0;
 }
 
+/*
+ * The GPU snoops userptr objects on LLC parts only, so without an LLC the CPU side of the
+ * memory is flushed around accesses like any other cached mapping. Kernels since 5.13 refuse
+ * to export userptr objects, so buffers to be shared should come from a memfd instead.
+ */
+static int i915_bo_create_from_userptr(struct bo *bo, void *ptr)
+{
+	struct drm_i915_gem_userptr userptr;
+	struct i915_bo *priv;
+	size_t plane;
+	int ret;
+
+	priv = calloc(1, sizeof(*priv));
+	if (!priv)
+		return -ENOMEM;
+
+	memset(&userptr, 0, sizeof(userptr));
+	userptr.user_ptr = (uintptr_t)ptr;
+	userptr.user_size = bo->meta.total_size;
+
+	ret = drmIoctl(bo->drv->fd, DRM_IOCTL_I915_GEM_USERPTR, &userptr);
+	if (ret) {
+		ret = -errno;
+		drv_log("DRM_IOCTL_I915_GEM_USERPTR failed (size=%llu)\n", userptr.user_size);
+		free(priv);
+		return ret;
+	}
+
+	for (plane = 0; plane < bo->meta.num_planes; plane++)
+		bo->handles[plane].u32 = userptr.handle;
+
+	priv->userptr = ptr;
+	bo->priv = priv;
+	return 0;
+}
+
 static void i915_close(struct driver *drv)
 {
 	free(drv->priv);
@@ -462,6 +557,7 @@ static void i915_close(struct driver *drv)
 
 static int i915_bo_import(struct bo *bo, struct drv_import_fd_data *data)
 {
+	struct i915_device *i915 = bo->drv->priv;
 	int ret;
 	struct drm_i915_gem_get_tiling gem_get_tiling;
 
@@ -469,6 +565,23 @@ static int i915_bo_import(struct bo *bo, struct drv_import_fd_data *data)
 	if (ret)
 		return ret;
 
+	/* GET_TILING needs fences, so take the tiling from the modifier instead. */
+	if (!i915->info.has_fences) {
+		switch (data->format_modifiers[0]) {
+		case I915_FORMAT_MOD_X_TILED:
+			bo->meta.tiling = I915_TILING_X;
+			break;
+		case I915_FORMAT_MOD_4_TILED:
+			bo->meta.tiling = I915_TILING_4;
+			break;
+		default:
+			bo->meta.tiling = I915_TILING_NONE;
+			break;
+		}
+		bo->priv = calloc(1, sizeof(struct i915_bo));
+		return 0;
+	}
+
 	/* TODO(gsingh): export modifiers and get rid of backdoor tiling. */
 	memset(&gem_get_tiling, 0, sizeof(gem_get_tiling));
 	gem_get_tiling.handle = bo->handles[0].u32;
@@ -481,33 +594,160 @@ static int i915_bo_import(struct bo *bo, struct drv_import_fd_data *data)
 	}
 
 	bo->meta.tiling = gem_get_tiling.tiling_mode;
+	bo->priv = calloc(1, sizeof(struct i915_bo));
 	return 0;
 }
 
+static void i915_bo_release(struct bo *bo)
+{
+	free(bo->priv);
+	bo->priv = NULL;
+}
+
+/*
+ * Returns > 0 when CPU access with map_flags would have to wait for the GPU: reads only wait
+ * for outstanding GPU writes, writes also wait for GPU reads.
+ */
+static int i915_bo_busy(struct bo *bo, uint32_t map_flags)
+{
+	struct drm_i915_gem_busy gem_busy;
+	int ret;
+
+	memset(&gem_busy, 0, sizeof(gem_busy));
+	gem_busy.handle = bo->handles[0].u32;
+
+	ret = drmIoctl(bo->drv->fd, DRM_IOCTL_I915_GEM_BUSY, &gem_busy);
+	if (ret) {
+		drv_log("DRM_IOCTL_I915_GEM_BUSY failed\n");
+		return -errno;
+	}
+
+	if (map_flags & BO_MAP_WRITE)
+		return gem_busy.busy != 0;
+
+	/* The low word holds the engine with an outstanding write, the high word readers. */
+	return (gem_busy.busy & 0xffff) != 0;
+}
+
+static int i915_bo_madvise(struct bo *bo, bool purgeable)
+{
+	struct i915_bo *priv = bo->priv;
+	struct drm_i915_gem_madvise madv;
+
+	/* The pages of a userptr object belong to the caller. */
+	if (priv && priv->userptr)
+		return 0;
+
+	memset(&madv, 0, sizeof(madv));
+	madv.handle = bo->handles[0].u32;
+	madv.madv = purgeable ? I915_MADV_DONTNEED : I915_MADV_WILLNEED;
+
+	if (drmIoctl(bo->drv->fd, DRM_IOCTL_I915_GEM_MADVISE, &madv)) {
+		drv_log("DRM_IOCTL_I915_GEM_MADVISE failed\n");
+		return -errno;
+	}
+
+	/* A purged object stays without backing store for good. */
+	return madv.retained ? 0 : 1;
+}
+
+/*
+ * Picks the CPU caching of a mapping. Reads through WC (or the GTT) are uncached and very
+ * slow, so buffers the CPU reads back get WB. Mappings that only write stream through WC,
+ * which also spares the clflush before the GPU sees the data on non-LLC parts. The map
+ * policy overrides the use flags when it has seen how the buffer is really accessed.
+ */
+static uint32_t i915_mmap_mode(struct bo *bo, struct vma *vma)
+{
+	struct i915_device *i915 = bo->drv->priv;
+
+	if (bo->meta.tiling != I915_TILING_NONE)
+		return I915_MMAP_OFFSET_GTT;
+
+	if (__atomic_load_n(&i915->mmap_offset_fixed, __ATOMIC_RELAXED))
+		return I915_MMAP_OFFSET_FIXED;
+
+	if (vma->map_cache == DRV_MAP_CACHE_CACHED)
+		return I915_MMAP_OFFSET_WB;
+
+	if (vma->map_cache == DRV_MAP_CACHE_WC)
+		return I915_MMAP_OFFSET_WC;
+
+	if (bo->meta.use_flags & (BO_USE_SW_READ_OFTEN | BO_USE_RENDERSCRIPT |
+				  BO_USE_CAMERA_READ | BO_USE_CAMERA_WRITE))
+		return I915_MMAP_OFFSET_WB;
+
+	if (!(vma->map_flags & BO_MAP_READ) || (bo->meta.use_flags & BO_USE_SCANOUT))
+		return I915_MMAP_OFFSET_WC;
+
+	return I915_MMAP_OFFSET_WB;
+}
+
+/* Updates *mode when the kernel made us fall back to I915_MMAP_OFFSET_FIXED. */
+static void *i915_bo_mmap_offset(struct bo *bo, uint32_t *mode, uint32_t map_flags)
+{
+	struct i915_device *i915 = bo->drv->priv;
+	struct drm_i915_gem_mmap_offset gem_map;
+	int ret;
+
+	memset(&gem_map, 0, sizeof(gem_map));
+	gem_map.handle = bo->handles[0].u32;
+	gem_map.flags = *mode;
+
+	ret = drmIoctl(bo->drv->fd, DRM_IOCTL_I915_GEM_MMAP_OFFSET, &gem_map);
+	if (ret && errno == ENODEV && *mode != I915_MMAP_OFFSET_FIXED &&
+	    *mode != I915_MMAP_OFFSET_GTT) {
+		/* Local memory parts pick the caching themselves and reject anything else. */
+		gem_map.flags = I915_MMAP_OFFSET_FIXED;
+		ret = drmIoctl(bo->drv->fd, DRM_IOCTL_I915_GEM_MMAP_OFFSET, &gem_map);
+		if (!ret) {
+			__atomic_store_n(&i915->mmap_offset_fixed, true, __ATOMIC_RELAXED);
+			*mode = I915_MMAP_OFFSET_FIXED;
+		}
+	}
+
+	if (ret) {
+		drv_log("DRM_IOCTL_I915_GEM_MMAP_OFFSET failed (mode=%u)\n", *mode);
+		return MAP_FAILED;
+	}
+
+	return mmap(0, bo->meta.total_size, drv_get_prot(map_flags), MAP_SHARED, bo->drv->fd,
+		    gem_map.offset);
+}
+
 static void *i915_bo_map(struct bo *bo, struct vma *vma, size_t plane, uint32_t map_flags)
 {
+	struct i915_device *i915 = bo->drv->priv;
+	struct i915_bo *priv = bo->priv;
+	uint32_t mode;
 	int ret;
-	void *addr;
+	void *addr = MAP_FAILED;
+
+	if (priv && priv->userptr) {
+		vma->length = bo->meta.total_size;
+		vma->map_mode = I915_MMAP_OFFSET_WB;
+		return priv->userptr;
+	}
 
 	if (bo->meta.format_modifiers[0] == I915_FORMAT_MOD_Y_TILED_CCS)
 		return MAP_FAILED;
 
+	mode = i915_mmap_mode(bo, vma);
+	if (i915->has_mmap_offset) {
+		addr = i915_bo_mmap_offset(bo, &mode, map_flags);
+		if (addr != MAP_FAILED)
+			goto out;
+	}
+
+	/* Kernels before 5.8, or a mode the kernel refused. */
 	if (bo->meta.tiling == I915_TILING_NONE) {
 		struct drm_i915_gem_mmap gem_map;
 		memset(&gem_map, 0, sizeof(gem_map));
 
-		/* TODO(b/118799155): We don't seem to have a good way to
-		 * detect the use cases for which WC mapping is really needed.
-		 * The current heuristic seems overly coarse and may be slowing
-		 * down some other use cases unnecessarily.
-		 *
-		 * For now, care must be taken not to use WC mappings for
-		 * Renderscript and camera use cases, as they're
-		 * performance-sensitive. */
-		if ((bo->meta.use_flags & BO_USE_SCANOUT) &&
-		    !(bo->meta.use_flags &
-		      (BO_USE_RENDERSCRIPT | BO_USE_CAMERA_READ | BO_USE_CAMERA_WRITE)))
+		if (mode == I915_MMAP_OFFSET_WC)
 			gem_map.flags = I915_MMAP_WC;
+		else
+			mode = I915_MMAP_OFFSET_WB;
 
 		gem_map.handle = bo->handles[0].u32;
 		gem_map.offset = 0;
@@ -534,6 +774,7 @@ static void *i915_bo_map(struct bo *bo, struct vma *vma, size_t plane, uint32_t
 
 		addr = mmap(0, bo->meta.total_size, drv_get_prot(map_flags), MAP_SHARED,
 			    bo->drv->fd, gem_map.offset);
+		mode = I915_MMAP_OFFSET_GTT;
 	}
 
 	if (addr == MAP_FAILED) {
@@ -541,18 +782,62 @@ static void *i915_bo_map(struct bo *bo, struct vma *vma, size_t plane, uint32_t
 		return addr;
 	}
 
+out:
 	vma->length = bo->meta.total_size;
+	vma->map_mode = mode;
 	return addr;
 }
 
+static int i915_bo_unmap(struct bo *bo, struct vma *vma)
+{
+	struct i915_bo *priv = bo->priv;
+
+	if (priv && priv->userptr)
+		return 0;
+
+	return drv_bo_munmap(bo, vma);
+}
+
+/*
+ * SET_DOMAIN blocks on the GPU and, without an LLC, clflushes the whole buffer. It can be
+ * skipped when we already moved the buffer to the wanted domain and the GPU has nothing
+ * outstanding that the CPU access would have to wait for. Without an LLC a cached CPU
+ * mapping could still hold stale lines from before a GPU write, so those always go through.
+ */
+static bool i915_bo_domain_current(struct bo *bo, uint32_t read_domains, uint32_t write_domain,
+				   uint32_t map_flags)
+{
+	struct i915_device *i915 = bo->drv->priv;
+	struct i915_bo *priv = bo->priv;
+
+	if (!priv)
+		return false;
+
+	if (__atomic_load_n(&priv->read_domains, __ATOMIC_RELAXED) != read_domains ||
+	    (write_domain && __atomic_load_n(&priv->write_domain, __ATOMIC_RELAXED) != write_domain))
+		return false;
+
+	if (!i915->has_llc && read_domains == I915_GEM_DOMAIN_CPU)
+		return false;
+
+	return i915_bo_busy(bo, map_flags) == 0;
+}
+
 static int i915_bo_invalidate(struct bo *bo, struct mapping *mapping)
 {
+	struct i915_device *i915 = bo->drv->priv;
+	struct i915_bo *priv = bo->priv;
 	int ret;
 	struct drm_i915_gem_set_domain set_domain;
 
 	memset(&set_domain, 0, sizeof(set_domain));
 	set_domain.handle = bo->handles[0].u32;
-	if (bo->meta.tiling == I915_TILING_NONE) {
+	if (mapping->vma->map_mode == I915_MMAP_OFFSET_WC) {
+		/* WC mappings bypass the CPU cache, so only pending GPU writes need flushing. */
+		set_domain.read_domains = I915_GEM_DOMAIN_WC;
+		if (mapping->vma->map_flags & BO_MAP_WRITE)
+			set_domain.write_domain = I915_GEM_DOMAIN_WC;
+	} else if (bo->meta.tiling == I915_TILING_NONE) {
 		set_domain.read_domains = I915_GEM_DOMAIN_CPU;
 		if (mapping->vma->map_flags & BO_MAP_WRITE)
 			set_domain.write_domain = I915_GEM_DOMAIN_CPU;
@@ -562,19 +847,33 @@ static int i915_bo_invalidate(struct bo *bo, struct mapping *mapping)
 			set_domain.write_domain = I915_GEM_DOMAIN_GTT;
 	}
 
+	if (i915_bo_domain_current(bo, set_domain.read_domains, set_domain.write_domain,
+				   mapping->vma->map_flags))
+		return 0;
+
 	ret = drmIoctl(bo->drv->fd, DRM_IOCTL_I915_GEM_SET_DOMAIN, &set_domain);
 	if (ret) {
 		drv_log("DRM_IOCTL_I915_GEM_SET_DOMAIN with %d\n", ret);
 		return ret;
 	}
 
+	/* The kernel only waits for the GPU on userptr objects, it does not flush them. */
+	if (priv && priv->userptr && !i915->has_llc)
+		i915_clflush(mapping->vma->addr, mapping->vma->length);
+
+	if (priv) {
+		__atomic_store_n(&priv->read_domains, set_domain.read_domains, __ATOMIC_RELAXED);
+		__atomic_store_n(&priv->write_domain, set_domain.write_domain, __ATOMIC_RELAXED);
+	}
+
 	return 0;
 }
 
 static int i915_bo_flush(struct bo *bo, struct mapping *mapping)
 {
 	struct i915_device *i915 = bo->drv->priv;
-	if (!i915->has_llc && bo->meta.tiling == I915_TILING_NONE)
+	if (!i915->has_llc && bo->meta.tiling == I915_TILING_NONE &&
+	    mapping->vma->map_mode != I915_MMAP_OFFSET_WC)
 		i915_clflush(mapping->vma->addr, mapping->vma->length);
 
 	return 0;
@@ -611,6 +910,18 @@ static uint32_t i915_resolve_format(struct driver *drv, uint32_t format, uint64_
 	}
 }
 
+static size_t i915_num_planes_from_modifier(struct driver *drv, uint32_t format,
+					    uint64_t modifier)
+{
+	size_t num_planes = drv_num_planes_from_format(format);
+
+	/* The CCS is an extra plane after the main surface. */
+	if (modifier == I915_FORMAT_MOD_Y_TILED_CCS)
+		return num_planes + 1;
+
+	return num_planes;
+}
+
 const struct backend backend_i915 = {
 	.name = "i915",
 	.init = i915_init,
@@ -618,12 +929,18 @@ const struct backend backend_i915 = {
 	.bo_compute_metadata = i915_bo_compute_metadata,
 	.bo_create_from_metadata = i915_bo_create_from_metadata,
 	.bo_destroy = drv_gem_bo_destroy,
+	.bo_release = i915_bo_release,
 	.bo_import = i915_bo_import,
+	.bo_create_from_userptr = i915_bo_create_from_userptr,
 	.bo_map = i915_bo_map,
-	.bo_unmap = drv_bo_munmap,
+	.bo_unmap = i915_bo_unmap,
 	.bo_invalidate = i915_bo_invalidate,
 	.bo_flush = i915_bo_flush,
+	.bo_busy = i915_bo_busy,
+	.bo_madvise = i915_bo_madvise,
 	.resolve_format = i915_resolve_format,
+	.num_planes_from_modifier = i915_num_planes_from_modifier,
+	.init_cache_priv_size = sizeof(struct i915_device),
 };
 
 #endif
@@ -0,0 +1,201 @@
+/*
+ * Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifdef DRV_I915
+
+#include <errno.h>
+#include <i915_drm.h>
+#include <stddef.h>
+
+#include "i915_device_info.h"
+#include "util.h"
+
+/*
+ * The Intel GPU doesn't need any alignment in linear mode, but libva requires the allocation
+ * stride to be aligned to 16 bytes and height to 4 rows. Further, we round up the horizontal
+ * alignment so that row start on a cache line (64 bytes).
+ */
+#define LINEAR_ALIGNMENT { 64, 4 }
+#define X_TILE_ALIGNMENT { 512, 8 }
+#define Y_TILE_ALIGNMENT { 128, 32 }
+/* Tile4 tiles have the Y tile footprint. */
+#define TILE4_ALIGNMENT Y_TILE_ALIGNMENT
+
+static const struct i915_device_info gen3_info = {
+	.gen = 3,
+	.has_fences = true,
+	.has_y_tiling = true,
+	.pot_stride = true,
+	.max_stride = 8192,
+	/* Gen3 Y tiles have the same footprint as X tiles. */
+	.alignment = { LINEAR_ALIGNMENT, X_TILE_ALIGNMENT, X_TILE_ALIGNMENT, X_TILE_ALIGNMENT },
+};
+
+static const struct i915_device_info gen4_info = {
+	.gen = 4,
+	.has_fences = true,
+	.has_y_tiling = true,
+	.alignment = { LINEAR_ALIGNMENT, X_TILE_ALIGNMENT, Y_TILE_ALIGNMENT, TILE4_ALIGNMENT },
+};
+
+static const struct i915_device_info gen9_info = {
+	.gen = 9,
+	.has_llc = true,
+	.has_fences = true,
+	.has_y_tiling = true,
+	.has_yf_tiling = true,
+	.has_ccs = true,
+	.alignment = { LINEAR_ALIGNMENT, X_TILE_ALIGNMENT, Y_TILE_ALIGNMENT, TILE4_ALIGNMENT },
+};
+
+/* Atom parts lack the LLC. */
+static const struct i915_device_info gen9_lp_info = {
+	.gen = 9,
+	.has_fences = true,
+	.has_y_tiling = true,
+	.has_yf_tiling = true,
+	.has_ccs = true,
+	.alignment = { LINEAR_ALIGNMENT, X_TILE_ALIGNMENT, Y_TILE_ALIGNMENT, TILE4_ALIGNMENT },
+};
+
+static const struct i915_device_info gen11_info = {
+	.gen = 11,
+	.has_llc = true,
+	.has_fences = true,
+	.has_y_tiling = true,
+	.has_yf_tiling = true,
+	.has_ccs = true,
+	.alignment = { LINEAR_ALIGNMENT, X_TILE_ALIGNMENT, Y_TILE_ALIGNMENT, TILE4_ALIGNMENT },
+};
+
+static const struct i915_device_info gen11_lp_info = {
+	.gen = 11,
+	.has_fences = true,
+	.has_y_tiling = true,
+	.has_yf_tiling = true,
+	.has_ccs = true,
+	.alignment = { LINEAR_ALIGNMENT, X_TILE_ALIGNMENT, Y_TILE_ALIGNMENT, TILE4_ALIGNMENT },
+};
+
+/*
+ * Gen12 dropped Yf, and its compression uses a different aux layout, which this backend
+ * doesn't allocate.
+ */
+static const struct i915_device_info gen12_info = {
+	.gen = 12,
+	.has_llc = true,
+	.has_fences = true,
+	.has_y_tiling = true,
+	.alignment = { LINEAR_ALIGNMENT, X_TILE_ALIGNMENT, Y_TILE_ALIGNMENT, TILE4_ALIGNMENT },
+};
+
+/* DG1 keeps the gen12 layouts in local memory, without an LLC. */
+static const struct i915_device_info gen12_dgfx_info = {
+	.gen = 12,
+	.has_fences = true,
+	.has_y_tiling = true,
+	.alignment = { LINEAR_ALIGNMENT, X_TILE_ALIGNMENT, Y_TILE_ALIGNMENT, TILE4_ALIGNMENT },
+};
+
+/* DG2 and MTL (Xe-HPG/Xe-LPG) replace Y with Tile4, and have neither fences nor an LLC. */
+static const struct i915_device_info gen12_tile4_info = {
+	.gen = 12,
+	.has_tile4 = true,
+	.alignment = { LINEAR_ALIGNMENT, X_TILE_ALIGNMENT, Y_TILE_ALIGNMENT, TILE4_ALIGNMENT },
+};
+
+struct i915_device_id {
+	uint16_t id;
+	uint16_t mask;
+	const struct i915_device_info *info;
+};
+
+/* First match wins, so exact ids go before the families they would otherwise fall into. */
+static const struct i915_device_id i915_device_ids[] = {
+	{ 0x2582, 0xFFFF, &gen3_info },
+	{ 0x2592, 0xFFFF, &gen3_info },
+	{ 0x2772, 0xFFFF, &gen3_info },
+	{ 0x27A2, 0xFFFF, &gen3_info },
+	{ 0x27AE, 0xFFFF, &gen3_info },
+	{ 0x29C2, 0xFFFF, &gen3_info },
+	{ 0x29B2, 0xFFFF, &gen3_info },
+	{ 0x29D2, 0xFFFF, &gen3_info },
+	{ 0xA001, 0xFFFF, &gen3_info },
+	{ 0xA011, 0xFFFF, &gen3_info },
+	/* BXT */
+	{ 0x0A84, 0xFFFF, &gen9_lp_info },
+	{ 0x1A84, 0xFFFF, &gen9_lp_info },
+	{ 0x1A85, 0xFFFF, &gen9_lp_info },
+	{ 0x5A84, 0xFFFF, &gen9_lp_info },
+	{ 0x5A85, 0xFFFF, &gen9_lp_info },
+	/* GLK */
+	{ 0x3184, 0xFFFF, &gen9_lp_info },
+	{ 0x3185, 0xFFFF, &gen9_lp_info },
+	/* SKL, KBL, CFL, CML, AML */
+	{ 0x1900, 0xFF00, &gen9_info },
+	{ 0x5900, 0xFF00, &gen9_info },
+	{ 0x3E00, 0xFF00, &gen9_info },
+	{ 0x9B00, 0xFF00, &gen9_info },
+	{ 0x8700, 0xFF00, &gen9_info },
+	/* ICL */
+	{ 0x8A00, 0xFF00, &gen11_info },
+	/* EHL, JSL */
+	{ 0x4500, 0xFF00, &gen11_lp_info },
+	{ 0x4E00, 0xFF00, &gen11_lp_info },
+	/* TGL */
+	{ 0x9A00, 0xFF00, &gen12_info },
+	/* RKL */
+	{ 0x4C80, 0xFFE0, &gen12_info },
+	/* ADL-S, ADL-P, ADL-N */
+	{ 0x4600, 0xFF00, &gen12_info },
+	/* RPL-S, RPL-P */
+	{ 0xA700, 0xFF00, &gen12_info },
+	/* DG1 */
+	{ 0x4900, 0xFFF0, &gen12_dgfx_info },
+	/* DG2 */
+	{ 0x5600, 0xFF00, &gen12_tile4_info },
+	/* MTL, ARL */
+	{ 0x7D00, 0xFF00, &gen12_tile4_info },
+};
+
+const struct i915_device_info *i915_get_device_info(uint16_t device_id)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(i915_device_ids); i++)
+		if ((device_id & i915_device_ids[i].mask) == i915_device_ids[i].id)
+			return i915_device_ids[i].info;
+
+	return &gen4_info;
+}
+
+int i915_device_info_align(const struct i915_device_info *info, uint32_t tiling,
+			   bool align_stride, uint32_t *stride, uint32_t *aligned_height)
+{
+	uint32_t horizontal_alignment;
+
+	if (tiling >= I915_NUM_TILING_MODES)
+		tiling = I915_TILING_NONE;
+
+	horizontal_alignment = info->alignment[tiling].horizontal;
+	*aligned_height = ALIGN(*aligned_height, info->alignment[tiling].vertical);
+
+	if (info->pot_stride) {
+		while (*stride > horizontal_alignment)
+			horizontal_alignment <<= 1;
+
+		*stride = horizontal_alignment;
+	} else if (align_stride) {
+		*stride = ALIGN(*stride, horizontal_alignment);
+	}
+
+	if (info->max_stride && *stride > info->max_stride)
+		return -EINVAL;
+
+	return 0;
+}
+
+#endif
@@ -0,0 +1,61 @@
+/*
+ * Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+#ifndef I915_DEVICE_INFO_H
+#define I915_DEVICE_INFO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Tile4 in bo->meta.tiling. It is not a SET_TILING mode: the parts that have it describe
+ * tiling through modifiers only.
+ */
+#define I915_TILING_4 3
+
+/* Indexed by I915_TILING_NONE, I915_TILING_X, I915_TILING_Y and I915_TILING_4. */
+#define I915_NUM_TILING_MODES 4
+
+struct i915_tile_alignment {
+	uint32_t horizontal;
+	uint32_t vertical;
+};
+
+/*
+ * What the backend needs to know about a GPU generation to lay buffers out. The lookups below
+ * only look at the PCI device id, so they can be exercised without the hardware.
+ */
+struct i915_device_info {
+	uint32_t gen;
+	/* Default for parts where I915_PARAM_HAS_LLC can't be queried. */
+	bool has_llc;
+	/* Fence registers, which SET_TILING/GET_TILING and tiled GTT maps need. */
+	bool has_fences;
+	/* Legacy Y tiling, which Tile4 replaces from DG2 on. */
+	bool has_y_tiling;
+	/* Yf tiling. Only accepted from clients, never picked for an allocation. */
+	bool has_yf_tiling;
+	bool has_tile4;
+	/* Y_TILED_CCS render compression. */
+	bool has_ccs;
+	/* Strides are rounded up to a power of two no smaller than the tile width. */
+	bool pot_stride;
+	/* Largest stride the display and sampler accept, or 0 for no limit. */
+	uint32_t max_stride;
+	struct i915_tile_alignment alignment[I915_NUM_TILING_MODES];
+};
+
+/* Never fails: unknown ids get the generic gen4+ description. */
+const struct i915_device_info *i915_get_device_info(uint16_t device_id);
+
+/*
+ * Applies the stride and height alignment for tiling to *stride and *aligned_height. Formats
+ * that must keep their natural stride pass align_stride = false. Returns -EINVAL when the
+ * result is too large for the device.
+ */
+int i915_device_info_align(const struct i915_device_info *info, uint32_t tiling,
+			   bool align_stride, uint32_t *stride, uint32_t *aligned_height);
+
+#endif
@@ -64,7 +64,7 @@ int i915_private_init(struct driver *drv, uint64_t *cursor_width, uint64_t *curs
 	return 0;
 }
 
-int i915_private_add_combinations(struct driver *drv)
+int i915_private_add_combinations(struct driver *drv, struct format_metadata *tiled)
 {
 	struct format_metadata metadata;
 	uint64_t render_flags, texture_flags;
@@ -98,11 +98,10 @@ int i915_private_add_combinations(struct driver *drv)
 			     ARRAY_SIZE(private_linear_source_formats), &metadata,
 			     texture_flags | BO_USE_CAMERA_MASK);
 
-	metadata.tiling = I915_TILING_Y;
-	metadata.priority = 3;
-	metadata.modifier = I915_FORMAT_MOD_Y_TILED;
-	drv_add_combinations(drv, private_source_formats, ARRAY_SIZE(private_source_formats),
-			     &metadata, texture_flags | BO_USE_NON_GPU_HW);
+	if (tiled)
+		drv_add_combinations(drv, private_source_formats,
+				     ARRAY_SIZE(private_source_formats), tiled,
+				     texture_flags | BO_USE_NON_GPU_HW);
 
 	texture_flags &= ~BO_USE_RENDERSCRIPT;
 	texture_flags &= ~BO_USE_SW_WRITE_OFTEN;
@@ -11,6 +11,7 @@
 #include "i915_private_types.h"
 
 struct driver;
+struct format_metadata;
 
 /*
  * 2 plane YCbCr MSB aligned
@@ -41,7 +42,8 @@ struct driver;
 
 int i915_private_init(struct driver *drv, uint64_t *cursor_width, uint64_t *cursor_height);
 
-int i915_private_add_combinations(struct driver *drv);
+/* tiled is the Y-tiled layout for the camera/media formats, or NULL if the part has none. */
+int i915_private_add_combinations(struct driver *drv, struct format_metadata *tiled);
 
 void i915_private_align_dimensions(uint32_t format, uint32_t *vertical_alignment);
 
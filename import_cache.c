@@ -0,0 +1,173 @@
+/*
+ * Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Per-driver cache of imported buffers. Importing the same dma-buf again, as split kms/render
+ * setups do, hands back the bo of the first import with one more reference instead of going
+ * through PRIME_FD_TO_HANDLE, lseek and the backend's import hook again. A bo leaves the cache when its last reference is destroyed.
+ *
+ * Buffers are identified by the inode behind their fd. The cached bo keeps the dma-buf alive,
+ * so the inode cannot be reused while it is in the cache. Kernels before 5.3 give all dma-bufs
+ * the one shared anonymous inode, so the cache stays out of the way there.
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "drv_priv.h"
+#include "helpers.h"
+#include "import_cache.h"
+#include "util.h"
+
+static struct stat drv_anon_inode;
+static bool drv_anon_inode_valid;
+static pthread_once_t drv_anon_inode_once = PTHREAD_ONCE_INIT;
+
+/* eventfds live on the anonymous inode that old kernels also put dma-bufs on. */
+static void drv_anon_inode_init_once(void)
+{
+	int fd = eventfd(0, EFD_CLOEXEC);
+
+	if (fd < 0)
+		return;
+
+	drv_anon_inode_valid = !fstat(fd, &drv_anon_inode);
+	close(fd);
+}
+
+bool drv_import_key_init(struct driver *drv, const struct drv_import_fd_data *data,
+			 struct drv_import_key *key)
+{
+	struct stat st;
+	size_t plane, num_planes;
+
+	num_planes = drv_num_planes_from_modifier(drv, data->format, data->format_modifiers[0]);
+	if (!num_planes)
+		return false;
+
+	pthread_once(&drv_anon_inode_once, drv_anon_inode_init_once);
+
+	memset(key, 0, sizeof(*key));
+
+	for (plane = 0; plane < num_planes; plane++) {
+		if (fstat(data->fds[plane], &st))
+			return false;
+
+		/* Planes in separate dma-bufs are rare enough not to bother. */
+		if (plane && (st.st_dev != key->dev || st.st_ino != key->ino))
+			return false;
+
+		key->dev = st.st_dev;
+		key->ino = st.st_ino;
+		key->strides[plane] = data->strides[plane];
+		key->offsets[plane] = data->offsets[plane];
+		key->format_modifiers[plane] = data->format_modifiers[plane];
+	}
+
+	if (!drv_anon_inode_valid ||
+	    (key->dev == drv_anon_inode.st_dev && key->ino == drv_anon_inode.st_ino))
+		return false;
+
+	key->width = data->width;
+	key->height = data->height;
+	key->format = data->format;
+	key->use_flags = data->use_flags;
+	return true;
+}
+
+/* Called with driver_lock held. */
+static struct drv_import_entry *drv_import_cache_find(struct driver *drv,
+						      const struct drv_import_key *key)
+{
+	struct drv_import_entry *entry;
+	uint32_t i;
+
+	for (i = 0; i < drv_array_size(drv->imports); i++) {
+		entry = drv_array_at_idx(drv->imports, i);
+		if (!memcmp(&entry->key, key, sizeof(*key)))
+			return entry;
+	}
+
+	return NULL;
+}
+
+struct bo *drv_import_cache_get(struct driver *drv, const struct drv_import_key *key)
+{
+	struct drv_import_entry *entry;
+	struct bo *bo = NULL;
+
+	pthread_mutex_lock(&drv->driver_lock);
+
+	entry = drv_import_cache_find(drv, key);
+	if (entry) {
+		bo = entry->bo;
+		bo->import_refs++;
+	}
+
+	pthread_mutex_unlock(&drv->driver_lock);
+
+	return bo;
+}
+
+struct bo *drv_import_cache_add(struct driver *drv, const struct drv_import_key *key,
+				struct bo *bo)
+{
+	struct drv_import_entry *entry, new_entry;
+	struct bo *cached;
+
+	pthread_mutex_lock(&drv->driver_lock);
+
+	entry = drv_import_cache_find(drv, key);
+	if (entry) {
+		cached = entry->bo;
+		cached->import_refs++;
+		pthread_mutex_unlock(&drv->driver_lock);
+
+		drv_bo_destroy(bo);
+		return cached;
+	}
+
+	memset(&new_entry, 0, sizeof(new_entry));
+	/* Keys are compared with memcmp(), so copy the padding as well. */
+	memcpy(&new_entry.key, key, sizeof(*key));
+	new_entry.bo = bo;
+
+	/* Without an entry the bo is simply not shared. */
+	if (drv_array_append(drv->imports, &new_entry))
+		bo->import_refs = 1;
+
+	pthread_mutex_unlock(&drv->driver_lock);
+
+	return bo;
+}
+
+bool drv_import_cache_put(struct bo *bo)
+{
+	struct driver *drv = bo->drv;
+	uint32_t i;
+
+	pthread_mutex_lock(&drv->driver_lock);
+
+	if (--bo->import_refs) {
+		pthread_mutex_unlock(&drv->driver_lock);
+		return false;
+	}
+
+	for (i = 0; i < drv_array_size(drv->imports); i++) {
+		struct drv_import_entry *entry = drv_array_at_idx(drv->imports, i);
+		if (entry->bo == bo) {
+			drv_array_remove(drv->imports, i);
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&drv->driver_lock);
+
+	return true;
+}
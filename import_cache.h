@@ -0,0 +1,48 @@
+/*
+ * Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef IMPORT_CACHE_H
+#define IMPORT_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "drv_priv.h"
+
+/* What makes two imports the same buffer: the dma-buf's inode and the layout on top of it. */
+struct drv_import_key {
+	dev_t dev;
+	ino_t ino;
+	uint32_t width;
+	uint32_t height;
+	uint32_t format;
+	uint64_t use_flags;
+	uint32_t strides[DRV_MAX_PLANES];
+	uint32_t offsets[DRV_MAX_PLANES];
+	uint64_t format_modifiers[DRV_MAX_PLANES];
+};
+
+struct drv_import_entry {
+	struct drv_import_key key;
+	struct bo *bo;
+};
+
+/* Returns false for imports that cannot be told apart reliably and so are not cached. */
+bool drv_import_key_init(struct driver *drv, const struct drv_import_fd_data *data,
+			 struct drv_import_key *key);
+/* Returns a new reference to the cached bo for key, or NULL. */
+struct bo *drv_import_cache_get(struct driver *drv, const struct drv_import_key *key);
+/*
+ * Caches a freshly imported bo. Returns the bo to use, which is an already cached one if
+ * another thread imported the same buffer in the meantime; bo is destroyed then.
+ */
+struct bo *drv_import_cache_add(struct driver *drv, const struct drv_import_key *key,
+				struct bo *bo);
+/* Drops a reference to a cached bo. Returns true when it was the last one. */
+bool drv_import_cache_put(struct bo *bo);
+
+#endif
@@ -0,0 +1,292 @@
+/*
+ * Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Snapshot of backend init state, shared between processes.
+ *
+ * Backends that set init_cache_priv_size promise that their init only fills drv->priv, which
+ * is plain data of that size, and the combination table. After a successful init both are
+ * written to a file; later processes on the same device mmap it and copy them back instead
+ * of calling init. The snapshot is keyed by everything init could depend on: the boot, the
+ * kernel, the device, the GPU group and the minigbm binary itself.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <link.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+#include "drv_priv.h"
+#include "helpers.h"
+#include "util.h"
+
+#define DRV_INIT_CACHE_MAGIC 0x4349474d /* "MGIC" */
+#define DRV_INIT_CACHE_VERSION 2
+#define DRV_BUILD_ID_MAX 32
+
+#ifndef NT_GNU_BUILD_ID
+#define NT_GNU_BUILD_ID 3
+#endif
+
+struct drv_init_cache_header {
+	uint32_t magic;
+	uint32_t version;
+	uint8_t build_id[DRV_BUILD_ID_MAX];
+	uint32_t build_id_len;
+	char boot_id[40];
+	char kernel[65];
+	char backend[16];
+	uint64_t rdev;
+	uint32_t vendor_id;
+	uint32_t device_id;
+	uint32_t gpu_grp_type;
+	uint32_t combo_size;
+	uint32_t priv_size;
+	/* Everything above is the key, the fields below describe the payload. */
+	uint32_t num_combos;
+	uint64_t checksum;
+};
+
+struct drv_build_id {
+	uint8_t id[DRV_BUILD_ID_MAX];
+	uint32_t len;
+};
+
+static pthread_once_t drv_build_id_once = PTHREAD_ONCE_INIT;
+static struct drv_build_id drv_build_id;
+
+static int drv_find_build_id(struct dl_phdr_info *info, size_t size, void *data)
+{
+	uintptr_t self = (uintptr_t)data;
+	bool found = false;
+	int i;
+
+	for (i = 0; i < info->dlpi_phnum; i++) {
+		const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+		uintptr_t start = info->dlpi_addr + phdr->p_vaddr;
+
+		if (phdr->p_type == PT_LOAD && self >= start && self < start + phdr->p_memsz)
+			found = true;
+	}
+
+	if (!found)
+		return 0;
+
+	for (i = 0; i < info->dlpi_phnum; i++) {
+		const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+		const uint8_t *note, *end;
+
+		if (phdr->p_type != PT_NOTE)
+			continue;
+
+		note = (const uint8_t *)(info->dlpi_addr + phdr->p_vaddr);
+		end = note + phdr->p_memsz;
+		while (note + sizeof(ElfW(Nhdr)) <= end) {
+			const ElfW(Nhdr) *nhdr = (const ElfW(Nhdr) *)note;
+			const uint8_t *name = note + sizeof(*nhdr);
+			const uint8_t *desc = name + ALIGN(nhdr->n_namesz, 4);
+
+			if (nhdr->n_type == NT_GNU_BUILD_ID && nhdr->n_namesz == 4 &&
+			    !memcmp(name, "GNU", 4) && nhdr->n_descsz <= DRV_BUILD_ID_MAX) {
+				memcpy(drv_build_id.id, desc, nhdr->n_descsz);
+				drv_build_id.len = nhdr->n_descsz;
+				return 1;
+			}
+
+			note = desc + ALIGN(nhdr->n_descsz, 4);
+		}
+	}
+
+	return 1;
+}
+
+/* The GNU build id of the object minigbm is linked into. */
+static void drv_read_build_id(void)
+{
+	dl_iterate_phdr(drv_find_build_id, (void *)(uintptr_t)drv_read_build_id);
+}
+
+static uint32_t drv_read_sysfs_id(dev_t rdev, const char *attr)
+{
+	char path[PATH_MAX], buf[16];
+	ssize_t len;
+	int fd;
+
+	snprintf(path, sizeof(path), "/sys/dev/char/%u:%u/device/%s", major(rdev), minor(rdev),
+		 attr);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0)
+		return 0;
+
+	buf[len] = '\0';
+	return strtoul(buf, NULL, 0);
+}
+
+/* FNV-1a over the combinations and priv, to catch corrupted or truncated snapshots. */
+static uint64_t drv_init_cache_checksum(const void *data, size_t size)
+{
+	const uint8_t *bytes = data;
+	uint64_t hash = 0xcbf29ce484222325ull;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
+	}
+
+	return hash;
+}
+
+static int drv_init_cache_key(struct driver *drv, struct drv_init_cache_header *key, char *path,
+			      size_t size)
+{
+	struct utsname uts;
+	struct stat st;
+	char name[64];
+
+	pthread_once(&drv_build_id_once, drv_read_build_id);
+
+	/* Without a build id a stale snapshot from another minigbm could not be detected. */
+	if (!drv->backend->init_cache_priv_size || !drv_build_id.len || drv->fd < 0)
+		return -ENOTSUP;
+
+	if (fstat(drv->fd, &st) || uname(&uts))
+		return -errno;
+
+	memset(key, 0, sizeof(*key));
+	key->magic = DRV_INIT_CACHE_MAGIC;
+	key->version = DRV_INIT_CACHE_VERSION;
+	memcpy(key->build_id, drv_build_id.id, drv_build_id.len);
+	key->build_id_len = drv_build_id.len;
+	if (drv_read_boot_id(key->boot_id, sizeof(key->boot_id)))
+		return -ENOENT;
+	snprintf(key->kernel, sizeof(key->kernel), "%s", uts.release);
+	snprintf(key->backend, sizeof(key->backend), "%s", drv->backend->name);
+	key->rdev = st.st_rdev;
+	key->vendor_id = drv_read_sysfs_id(st.st_rdev, "vendor");
+	key->device_id = drv_read_sysfs_id(st.st_rdev, "device");
+	key->gpu_grp_type = drv->gpu_grp_type;
+	key->combo_size = sizeof(struct combination);
+	key->priv_size = drv->backend->init_cache_priv_size;
+
+	snprintf(name, sizeof(name), "init-%s-%u-%u", drv->backend->name, major(st.st_rdev),
+		 minor(st.st_rdev));
+	return drv_cache_path(name, path, size);
+}
+
+int drv_init_cache_load(struct driver *drv)
+{
+	struct drv_init_cache_header key;
+	const struct drv_init_cache_header *header;
+	const struct combination *combos;
+	char path[PATH_MAX];
+	struct stat st;
+	size_t size;
+	void *addr;
+	uint32_t i;
+	int fd, ret;
+
+	ret = drv_init_cache_key(drv, &key, path, sizeof(path));
+	if (ret)
+		return ret;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	if (fstat(fd, &st) || st.st_uid != geteuid() || (size_t)st.st_size < sizeof(key)) {
+		close(fd);
+		return -ENOENT;
+	}
+
+	addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED)
+		return -errno;
+
+	header = addr;
+	if (memcmp(header, &key, offsetof(struct drv_init_cache_header, num_combos))) {
+		ret = -ENOENT;
+		goto out;
+	}
+
+	/* Checked against the file size first so that the multiplication cannot overflow. */
+	size = st.st_size - sizeof(*header);
+	if (size < key.priv_size || header->num_combos > (size - key.priv_size) / key.combo_size ||
+	    size != (size_t)header->num_combos * key.combo_size + key.priv_size ||
+	    header->checksum != drv_init_cache_checksum(header + 1, size)) {
+		drv_log("Ignoring corrupted init cache %s\n", path);
+		ret = -ENOENT;
+		goto out;
+	}
+
+	drv->priv = calloc(1, key.priv_size);
+	if (!drv->priv) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	combos = (const struct combination *)(header + 1);
+	memcpy(drv->priv, combos + header->num_combos, key.priv_size);
+	for (i = 0; i < header->num_combos; i++)
+		drv_array_append(drv->combos, &combos[i]);
+
+	if (drv->backend->init_cache_restore)
+		drv->backend->init_cache_restore(drv);
+
+out:
+	munmap(addr, st.st_size);
+	return ret;
+}
+
+void drv_init_cache_store(struct driver *drv)
+{
+	struct drv_init_cache_header *header;
+	char path[PATH_MAX];
+	uint8_t *data;
+	uint32_t i, num_combos;
+	size_t size;
+
+	if (!drv->backend->init_cache_priv_size)
+		return;
+
+	num_combos = drv_array_size(drv->combos);
+	size = sizeof(*header) + (size_t)num_combos * sizeof(struct combination) +
+	       drv->backend->init_cache_priv_size;
+	data = calloc(1, size);
+	if (!data)
+		return;
+
+	header = (struct drv_init_cache_header *)data;
+	if (drv_init_cache_key(drv, header, path, sizeof(path))) {
+		free(data);
+		return;
+	}
+	header->num_combos = num_combos;
+
+	for (i = 0; i < num_combos; i++)
+		memcpy(data + sizeof(*header) + i * sizeof(struct combination),
+		       drv_array_at_idx(drv->combos, i), sizeof(struct combination));
+	memcpy(data + sizeof(*header) + num_combos * sizeof(struct combination), drv->priv,
+	       drv->backend->init_cache_priv_size);
+	header->checksum = drv_init_cache_checksum(header + 1, size - sizeof(*header));
+
+	drv_write_file_atomic(path, data, size);
+	free(data);
+}
@@ -0,0 +1,161 @@
+/*
+ * Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Picks the CPU caching of new mappings from how a buffer has actually been mapped so far.
+ *
+ * Use flags are often wrong: a buffer allocated SW_WRITE_RARELY may be read back every frame,
+ * and reads through a WC mapping are an order of magnitude slower than through a cached one.
+ * Every drv_bo_map() call updates the buffer's access profile. Once there are enough samples,
+ * buffers that are mostly read back in large regions get cached mappings and buffers that are
+ * never read get WC ones. Otherwise the backend's use flag heuristics stay in charge.
+ *
+ * MINIGBM_MAP_POLICY selects the behaviour:
+ *	adaptive	the above (default)
+ *	flags		never adapt, the backend decides from the use flags
+ *	cached, wc	force that caching for every mapping
+ *
+ * New mappings can also be pre-faulted, which moves one fault per page out of the first lock.
+ * MINIGBM_MAP_POPULATE is the default for drv_set_map_populate():
+ *	auto		writable mappings of SW_WRITE_OFTEN and CAMERA_WRITE buffers (default)
+ *	always, never
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "drv_priv.h"
+#include "helpers.h"
+#include "map_policy.h"
+#include "stats.h"
+#include "util.h"
+
+/* Maps seen before the profile is trusted. */
+#define DRV_MAP_POLICY_WARMUP 4
+/* Counters are halved past this, so that the profile follows changes in behaviour. */
+#define DRV_MAP_POLICY_WINDOW 256
+
+enum drv_map_policy {
+	DRV_MAP_POLICY_ADAPTIVE,
+	DRV_MAP_POLICY_FLAGS,
+	DRV_MAP_POLICY_CACHED,
+	DRV_MAP_POLICY_WC,
+};
+
+static enum drv_map_policy drv_map_policy;
+static pthread_once_t drv_map_policy_once = PTHREAD_ONCE_INIT;
+static enum drv_map_populate drv_map_populate_default = DRV_MAP_POPULATE_AUTO;
+
+static void drv_map_policy_init_once(void)
+{
+	const char *env = getenv("MINIGBM_MAP_POLICY");
+
+	if (!env || !strcmp(env, "adaptive"))
+		drv_map_policy = DRV_MAP_POLICY_ADAPTIVE;
+	else if (!strcmp(env, "flags"))
+		drv_map_policy = DRV_MAP_POLICY_FLAGS;
+	else if (!strcmp(env, "cached"))
+		drv_map_policy = DRV_MAP_POLICY_CACHED;
+	else if (!strcmp(env, "wc"))
+		drv_map_policy = DRV_MAP_POLICY_WC;
+	else
+		drv_log("Unknown MINIGBM_MAP_POLICY %s, using adaptive\n", env);
+
+	env = getenv("MINIGBM_MAP_POPULATE");
+	if (!env || !strcmp(env, "auto"))
+		drv_map_populate_default = DRV_MAP_POPULATE_AUTO;
+	else if (!strcmp(env, "always"))
+		drv_map_populate_default = DRV_MAP_POPULATE_ALWAYS;
+	else if (!strcmp(env, "never"))
+		drv_map_populate_default = DRV_MAP_POPULATE_NEVER;
+	else
+		drv_log("Unknown MINIGBM_MAP_POPULATE %s, using auto\n", env);
+}
+
+void drv_map_policy_record(struct bo *bo, const struct rectangle *rect, uint32_t map_flags,
+			   size_t plane)
+{
+	struct drv_access_profile *access = &bo->access;
+
+	if (access->maps >= DRV_MAP_POLICY_WINDOW) {
+		access->maps /= 2;
+		access->read_maps /= 2;
+		access->write_maps /= 2;
+		access->read_bytes /= 2;
+	}
+
+	access->maps++;
+	if (map_flags & BO_MAP_READ) {
+		access->read_maps++;
+		access->read_bytes += (uint64_t)rect->height * bo->meta.strides[plane];
+	}
+	if (map_flags & BO_MAP_WRITE)
+		access->write_maps++;
+}
+
+static enum drv_map_cache drv_map_policy_adapt(const struct drv_access_profile *access)
+{
+	if (access->maps < DRV_MAP_POLICY_WARMUP)
+		return DRV_MAP_CACHE_DEFAULT;
+
+	if (!access->read_maps)
+		return DRV_MAP_CACHE_WC;
+
+	/* Reading back a line or two through WC is cheap; whole frames are not. */
+	if (access->read_maps * 2 >= access->maps &&
+	    access->read_bytes / access->read_maps >= (uint64_t)getpagesize())
+		return DRV_MAP_CACHE_CACHED;
+
+	return DRV_MAP_CACHE_DEFAULT;
+}
+
+enum drv_map_cache drv_map_policy_select(struct bo *bo)
+{
+	enum drv_map_cache cache;
+
+	pthread_once(&drv_map_policy_once, drv_map_policy_init_once);
+
+	switch (drv_map_policy) {
+	case DRV_MAP_POLICY_CACHED:
+		cache = DRV_MAP_CACHE_CACHED;
+		break;
+	case DRV_MAP_POLICY_WC:
+		cache = DRV_MAP_CACHE_WC;
+		break;
+	case DRV_MAP_POLICY_FLAGS:
+		cache = DRV_MAP_CACHE_DEFAULT;
+		break;
+	default:
+		cache = drv_map_policy_adapt(&bo->access);
+		break;
+	}
+
+	drv_stats_map_cache(cache, drv_map_policy == DRV_MAP_POLICY_ADAPTIVE &&
+					   cache != DRV_MAP_CACHE_DEFAULT);
+	return cache;
+}
+
+bool drv_map_policy_populate(struct bo *bo, uint32_t map_flags)
+{
+	enum drv_map_populate populate = bo->drv->map_populate;
+
+	pthread_once(&drv_map_policy_once, drv_map_policy_init_once);
+
+	if (populate == DRV_MAP_POPULATE_DEFAULT)
+		populate = drv_map_populate_default;
+
+	switch (populate) {
+	case DRV_MAP_POPULATE_ALWAYS:
+		return true;
+	case DRV_MAP_POPULATE_NEVER:
+		return false;
+	default:
+		return (map_flags & BO_MAP_WRITE) &&
+		       (bo->meta.use_flags & (BO_USE_SW_WRITE_OFTEN | BO_USE_CAMERA_WRITE));
+	}
+}
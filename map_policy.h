@@ -0,0 +1,21 @@
+/*
+ * Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef MAP_POLICY_H
+#define MAP_POLICY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "drv.h"
+
+/* All are called by drv_bo_map() with driver_lock held. */
+void drv_map_policy_record(struct bo *bo, const struct rectangle *rect, uint32_t map_flags,
+			   size_t plane);
+enum drv_map_cache drv_map_policy_select(struct bo *bo);
+bool drv_map_policy_populate(struct bo *bo, uint32_t map_flags);
+
+#endif
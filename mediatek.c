@@ -10,7 +10,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
-#include <poll.h>
+#include <linux/dma-buf.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/mman.h>
@@ -193,7 +193,7 @@ static void *mediatek_bo_map(struct bo *bo, struct vma *vma, size_t plane, uint3
 	priv->prime_fd = prime_fd;
 	vma->priv = priv;
 
-	if (bo->meta.use_flags & BO_USE_RENDERSCRIPT) {
+	if (drv_map_wants_shadow(bo, vma)) {
 		priv->cached_addr = calloc(1, bo->meta.total_size);
 		priv->gem_addr = addr;
 		addr = priv->cached_addr;
@@ -225,21 +225,9 @@ static int mediatek_bo_invalidate(struct bo *bo, struct mapping *mapping)
 	struct mediatek_private_map_data *priv = mapping->vma->priv;
 
 	if (priv) {
-		struct pollfd fds = {
-			.fd = priv->prime_fd,
-		};
+		drv_dmabuf_sync(priv->prime_fd, DMA_BUF_SYNC_START, mapping->vma->map_flags);
 
-		if (mapping->vma->map_flags & BO_MAP_WRITE)
-			fds.events |= POLLOUT;
-
-		if (mapping->vma->map_flags & BO_MAP_READ)
-			fds.events |= POLLIN;
-
-		poll(&fds, 1, -1);
-		if (fds.revents != fds.events)
-			drv_log("poll prime_fd failed\n");
-
-		if (priv->cached_addr)
+		if (priv->cached_addr && !drv_mapping_discards_all(bo, mapping))
 			memcpy(priv->cached_addr, priv->gem_addr, bo->meta.total_size);
 	}
 
@@ -249,10 +237,14 @@ static int mediatek_bo_invalidate(struct bo *bo, struct mapping *mapping)
 static int mediatek_bo_flush(struct bo *bo, struct mapping *mapping)
 {
 	struct mediatek_private_map_data *priv = mapping->vma->priv;
-	if (priv && priv->cached_addr && (mapping->vma->map_flags & BO_MAP_WRITE))
+
+	if (!priv)
+		return 0;
+
+	if (priv->cached_addr && (mapping->vma->map_flags & BO_MAP_WRITE))
 		memcpy(priv->gem_addr, priv->cached_addr, bo->meta.total_size);
 
-	return 0;
+	return drv_dmabuf_sync(priv->prime_fd, DMA_BUF_SYNC_END, mapping->vma->map_flags);
 }
 
 static uint32_t mediatek_resolve_format(struct driver *drv, uint32_t format, uint64_t use_flags)
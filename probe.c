@@ -0,0 +1,293 @@
+/*
+ * Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Render node discovery.
+ *
+ * Nodes are found by listing DRM_DIR_NAME instead of trying every possible minor. The driver
+ * name of a node comes from its sysfs driver link, so probing needs no ioctl for the drivers
+ * minigbm has backends for, and it is cached in a small file so that later processes need
+ * not even open the nodes they don't use. The cache is keyed by the kernel boot id and by the mtime of
+ * DRM_DIR_NAME, which changes whenever a node is added or removed, and each entry is checked
+ * against the device number of the node it opens. Anything that does not match falls back
+ * to probing.
+ *
+ * MINIGBM_PROBE_CACHE overrides the cache path, an empty value disables the cache.
+ * Otherwise the cache lives next to the others, see drv_cache_path().
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+#include <xf86drm.h>
+
+#include "drv_priv.h"
+#include "helpers.h"
+#include "util.h"
+
+#define DRV_PROBE_CACHE_MAGIC 0x4350474d /* "MGPC" */
+#define DRV_PROBE_CACHE_VERSION 1
+#define DRV_PROBE_PATH_LEN 64
+
+struct drv_probe_cache_entry {
+	char path[DRV_PROBE_PATH_LEN];
+	char name[32];
+	uint64_t rdev;
+};
+
+struct drv_probe_cache {
+	uint32_t magic;
+	uint32_t version;
+	char boot_id[40];
+	int64_t dir_mtime_sec;
+	int64_t dir_mtime_nsec;
+	uint32_t count;
+	struct drv_probe_cache_entry entries[DRV_MAX_RENDER_NODES];
+};
+
+static int drv_probe_cache_path(char *path, size_t size)
+{
+	const char *env = getenv("MINIGBM_PROBE_CACHE");
+
+	if (env) {
+		if (!env[0])
+			return -ENOENT;
+		snprintf(path, size, "%s", env);
+		return 0;
+	}
+
+	return drv_cache_path("probe", path, size);
+}
+
+/* Fills the boot id and DRM_DIR_NAME mtime that a cache must match to be used. */
+static int drv_probe_cache_key(struct drv_probe_cache *cache)
+{
+	struct stat st;
+	int ret;
+
+	ret = drv_read_boot_id(cache->boot_id, sizeof(cache->boot_id));
+	if (ret)
+		return ret;
+
+	if (stat(DRM_DIR_NAME, &st))
+		return -errno;
+
+	cache->magic = DRV_PROBE_CACHE_MAGIC;
+	cache->version = DRV_PROBE_CACHE_VERSION;
+	cache->dir_mtime_sec = st.st_mtim.tv_sec;
+	cache->dir_mtime_nsec = st.st_mtim.tv_nsec;
+	return 0;
+}
+
+int drv_get_driver_name(int fd, char *name, size_t size)
+{
+	char link[PATH_MAX], target[PATH_MAX];
+	drmVersionPtr version;
+	const char *driver;
+	struct stat st;
+	ssize_t len;
+
+	/* The sysfs name is only trusted where it is known to match the DRM driver name. */
+	if (!fstat(fd, &st) && S_ISCHR(st.st_mode)) {
+		snprintf(link, sizeof(link), "/sys/dev/char/%u:%u/device/driver",
+			 major(st.st_rdev), minor(st.st_rdev));
+		len = readlink(link, target, sizeof(target) - 1);
+		if (len > 0) {
+			target[len] = '\0';
+			driver = strrchr(target, '/');
+			driver = driver ? driver + 1 : target;
+			if (drv_is_backend_name(driver)) {
+				snprintf(name, size, "%s", driver);
+				return 0;
+			}
+		}
+	}
+
+	version = drmGetVersion(fd);
+	if (!version)
+		return -ENODEV;
+
+	snprintf(name, size, "%s", version->name);
+	drmFreeVersion(version);
+	return 0;
+}
+
+static void drv_close_render_nodes(struct drv_render_node *nodes, uint32_t count)
+{
+	uint32_t i;
+
+	for (i = 0; i < count; i++)
+		close(nodes[i].fd);
+}
+
+static int drv_probe_from_cache(const char *path, struct drv_render_node *nodes, uint32_t max)
+{
+	struct drv_probe_cache key, cache;
+	struct stat st;
+	uint32_t i;
+	ssize_t len;
+	int fd;
+
+	memset(&key, 0, sizeof(key));
+	if (drv_probe_cache_key(&key))
+		return -ENOENT;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -ENOENT;
+
+	/* Only trust caches written by ourselves. */
+	if (fstat(fd, &st) || st.st_uid != geteuid()) {
+		close(fd);
+		return -ENOENT;
+	}
+
+	len = read(fd, &cache, sizeof(cache));
+	close(fd);
+
+	if (len != sizeof(cache) || cache.magic != key.magic || cache.version != key.version ||
+	    memcmp(cache.boot_id, key.boot_id, sizeof(key.boot_id)) ||
+	    cache.dir_mtime_sec != key.dir_mtime_sec ||
+	    cache.dir_mtime_nsec != key.dir_mtime_nsec || cache.count > max ||
+	    cache.count > DRV_MAX_RENDER_NODES)
+		return -ENOENT;
+
+	for (i = 0; i < cache.count; i++) {
+		struct drv_probe_cache_entry *entry = &cache.entries[i];
+
+		entry->path[sizeof(entry->path) - 1] = '\0';
+		entry->name[sizeof(entry->name) - 1] = '\0';
+
+		nodes[i].fd = open(entry->path, O_RDWR | O_CLOEXEC);
+		if (nodes[i].fd < 0)
+			goto fail;
+
+		if (fstat(nodes[i].fd, &st) || st.st_rdev != entry->rdev) {
+			close(nodes[i].fd);
+			goto fail;
+		}
+
+		memcpy(nodes[i].name, entry->name, sizeof(nodes[i].name));
+	}
+
+	return cache.count;
+
+fail:
+	drv_close_render_nodes(nodes, i);
+	return -ENOENT;
+}
+
+static int drv_compare_node_paths(const void *a, const void *b)
+{
+	const char *x = a, *y = b;
+	size_t lx = strlen(x), ly = strlen(y);
+
+	/* Same prefix, so shorter means a smaller minor. */
+	return (lx != ly) ? (lx > ly) - (lx < ly) : strcmp(x, y);
+}
+
+static int drv_probe_nodes(struct drv_render_node *nodes, uint32_t max,
+			   struct drv_probe_cache *cache)
+{
+	char paths[DRV_MAX_RENDER_NODES][DRV_PROBE_PATH_LEN];
+	uint32_t i, num_paths = 0, num_dropped = 0, count = 0;
+	struct dirent *dent;
+	struct stat st;
+	DIR *dir;
+	int fd;
+
+	dir = opendir(DRM_DIR_NAME);
+	if (!dir)
+		return -errno;
+
+	while ((dent = readdir(dir))) {
+		if (strncmp(dent->d_name, "renderD", strlen("renderD")))
+			continue;
+
+		if (num_paths == ARRAY_SIZE(paths)) {
+			num_dropped++;
+			continue;
+		}
+
+		if (snprintf(paths[num_paths], DRV_PROBE_PATH_LEN, "%s/%s", DRM_DIR_NAME,
+			     dent->d_name) < DRV_PROBE_PATH_LEN)
+			num_paths++;
+	}
+	closedir(dir);
+
+	if (num_dropped)
+		drv_log("Ignoring %u render nodes beyond the first %u.\n", num_dropped, num_paths);
+
+	qsort(paths, num_paths, sizeof(paths[0]), drv_compare_node_paths);
+
+	for (i = 0; i < num_paths; i++) {
+		if (count == max) {
+			drv_log("Ignoring %s and later render nodes, only %u requested.\n", paths[i],
+				max);
+			break;
+		}
+
+		fd = open(paths[i], O_RDWR | O_CLOEXEC);
+		if (fd < 0)
+			continue;
+
+		if (fstat(fd, &st) ||
+		    drv_get_driver_name(fd, nodes[count].name, sizeof(nodes[count].name))) {
+			close(fd);
+			continue;
+		}
+
+		nodes[count].fd = fd;
+		memcpy(cache->entries[count].path, paths[i], DRV_PROBE_PATH_LEN);
+		memcpy(cache->entries[count].name, nodes[count].name, sizeof(nodes[count].name));
+		cache->entries[count].rdev = st.st_rdev;
+		count++;
+	}
+
+	cache->count = count;
+	return count;
+}
+
+int drv_find_render_nodes(struct drv_render_node *nodes, uint32_t max)
+{
+	struct drv_probe_cache cache;
+	char path[PATH_MAX];
+	bool use_cache;
+	int ret;
+
+	use_cache = !drv_probe_cache_path(path, sizeof(path));
+	if (use_cache) {
+		ret = drv_probe_from_cache(path, nodes, max);
+		if (ret >= 0)
+			return ret;
+	}
+
+	memset(&cache, 0, sizeof(cache));
+	/* A cache without a key would never match, so don't write one. */
+	if (drv_probe_cache_key(&cache))
+		use_cache = false;
+
+	ret = drv_probe_nodes(nodes, max, &cache);
+	if (ret >= 0 && use_cache && (uint32_t)ret < max)
+		drv_write_file_atomic(path, &cache, sizeof(cache));
+
+	return ret;
+}
+
+void drv_probe_cache_clear(void)
+{
+	char path[PATH_MAX];
+
+	if (!drv_probe_cache_path(path, sizeof(path)))
+		unlink(path);
+}
@@ -209,7 +209,7 @@ static void *rockchip_bo_map(struct bo *bo, struct vma *vma, size_t plane, uint3
 
 	vma->length = bo->meta.total_size;
 
-	if (bo->meta.use_flags & BO_USE_RENDERSCRIPT) {
+	if (drv_map_wants_shadow(bo, vma)) {
 		priv = calloc(1, sizeof(*priv));
 		priv->cached_addr = calloc(1, bo->meta.total_size);
 		priv->gem_addr = addr;
@@ -235,7 +235,7 @@ static int rockchip_bo_unmap(struct bo *bo, struct vma *vma)
 
 static int rockchip_bo_invalidate(struct bo *bo, struct mapping *mapping)
 {
-	if (mapping->vma->priv) {
+	if (mapping->vma->priv && !drv_mapping_discards_all(bo, mapping)) {
 		struct rockchip_private_map_data *priv = mapping->vma->priv;
 		memcpy(priv->cached_addr, priv->gem_addr, bo->meta.total_size);
 	}
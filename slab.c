@@ -0,0 +1,283 @@
+/*
+ * Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Sub-allocator for small linear buffers: cursor-sized textures, icons and BLOB buffers are
+ * carved out of larger backing objects instead of each costing a GEM object, a PRIME export
+ * and at least a page. A slab holds 64 equal chunks of one size class and is only shared by
+ * buffers with identical use flags, so the backend's caching and domain decisions still hold.
+ *
+ * The buffers point their handles at the backing object and carry their chunk offset in the
+ * plane offsets. Every buffer takes a reference on the handle through the buffer_table like an
+ * import would, so the backing object lives until its slab is dropped and all of them are gone.
+ *
+ * Memory accounting counts the backing objects, under a "slab" entry of their own, and not the
+ * buffers in them, so that every byte shows up once.
+ *
+ * An exported buffer exposes the whole backing object, including its neighbours, to the
+ * importer. That is why this is opt-in, with MINIGBM_SLAB=1.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "drv_priv.h"
+#include "helpers.h"
+#include "slab.h"
+#include "stats.h"
+#include "trace.h"
+#include "util.h"
+
+#define DRV_SLAB_CHUNKS 64
+
+/* The hardware can use these, and needs buffers to start on a page. */
+#define DRV_SLAB_GPU_USE (BO_USE_RENDERING | BO_USE_TEXTURE)
+/*
+ * Scanout and cursor buffers are passed to KMS by handle, video and camera engines have their
+ * own base alignment rules, and protected buffers must not share an object.
+ */
+#define DRV_SLAB_EXCLUDED_USE                                                                      \
+	(BO_USE_SCANOUT | BO_USE_CURSOR | BO_USE_PROTECTED | BO_USE_CAMERA_READ |                  \
+	 BO_USE_CAMERA_WRITE | BO_USE_HW_VIDEO_DECODER | BO_USE_HW_VIDEO_ENCODER)
+
+static const uint32_t drv_slab_classes[] = { 1024, 4096, 16384 };
+
+static bool drv_slab_enabled;
+static pthread_once_t drv_slab_once = PTHREAD_ONCE_INIT;
+
+static void drv_slab_init_once(void)
+{
+	const char *env = getenv("MINIGBM_SLAB");
+
+	drv_slab_enabled = env && !strcmp(env, "1");
+}
+
+static uint32_t drv_slab_class(uint64_t use_flags, uint32_t extent)
+{
+	uint32_t min = (use_flags & DRV_SLAB_GPU_USE) ? getpagesize() : 0;
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(drv_slab_classes); i++)
+		if (drv_slab_classes[i] >= extent && drv_slab_classes[i] >= min)
+			return drv_slab_classes[i];
+
+	return 0;
+}
+
+static struct drv_slab *drv_slab_find(struct driver *drv, uint64_t use_flags, uint32_t chunk_size)
+{
+	struct drv_slab *slab;
+	uint32_t i;
+
+	for (i = 0; i < drv_array_size(drv->slabs); i++) {
+		slab = drv_array_at_idx(drv->slabs, i);
+		if (slab->use_flags == use_flags && slab->chunk_size == chunk_size &&
+		    slab->free_mask)
+			return slab;
+	}
+
+	return NULL;
+}
+
+static struct bo *drv_slab_create_backing(struct driver *drv, uint64_t use_flags,
+					  uint32_t chunk_size)
+{
+	struct bo *bo;
+
+	/* One R8 row per chunk keeps every backend's linear stride rules satisfied. */
+	bo = drv_bo_create_slab_backing(drv, chunk_size, DRV_SLAB_CHUNKS, DRM_FORMAT_R8,
+					use_flags | BO_USE_LINEAR);
+	if (!bo)
+		return NULL;
+
+	if (bo->meta.format_modifiers[0] != DRM_FORMAT_MOD_LINEAR ||
+	    bo->meta.strides[0] != chunk_size || bo->meta.num_planes != 1) {
+		drv_bo_destroy(bo);
+		return NULL;
+	}
+
+	return bo;
+}
+
+/* Called with driver_lock held. Takes the first free chunk of slab for bo. */
+static void drv_slab_claim(struct driver *drv, struct drv_slab *slab, struct bo *bo)
+{
+	uint32_t chunk = __builtin_ctzll(slab->free_mask);
+	size_t plane;
+
+	slab->free_mask &= ~(1ull << chunk);
+
+	for (plane = 0; plane < bo->meta.num_planes; plane++) {
+		bo->meta.offsets[plane] += chunk * slab->chunk_size;
+		bo->handles[plane] = slab->bo->handles[0];
+		drv_increment_reference_count(drv, bo, plane);
+	}
+
+	bo->meta.total_size = slab->chunk_size;
+	bo->slab = slab;
+}
+
+static struct bo *drv_slab_bo_alloc(struct driver *drv, uint32_t width, uint32_t height,
+				     uint32_t format, uint64_t use_flags)
+{
+	uint64_t modifier = DRM_FORMAT_MOD_LINEAR;
+	struct drv_slab *slab, new_slab;
+	uint32_t extent = 0, chunk_size;
+	struct bo *bo, *backing;
+	size_t plane;
+
+	bo = drv_bo_new(drv, width, height, format, use_flags, false);
+	if (!bo)
+		return NULL;
+
+	if (drv->backend->bo_compute_metadata(bo, width, height, format, use_flags, &modifier, 1))
+		goto fail;
+
+	for (plane = 0; plane < bo->meta.num_planes; plane++)
+		extent = MAX(extent, bo->meta.offsets[plane] + bo->meta.sizes[plane]);
+
+	chunk_size = drv_slab_class(use_flags, extent);
+	if (!chunk_size)
+		goto fail;
+
+	/* The slab can only go away under the lock, so keep it from lookup to claim. */
+	pthread_mutex_lock(&drv->driver_lock);
+	slab = drv_slab_find(drv, use_flags, chunk_size);
+	if (slab) {
+		drv_slab_claim(drv, slab, bo);
+		pthread_mutex_unlock(&drv->driver_lock);
+		return bo;
+	}
+	pthread_mutex_unlock(&drv->driver_lock);
+
+	/* Creating the backing object takes the lock itself. */
+	backing = drv_slab_create_backing(drv, use_flags, chunk_size);
+	if (!backing)
+		goto fail;
+
+	pthread_mutex_lock(&drv->driver_lock);
+	/* Another thread may have added a slab in the meantime; use that one then. */
+	slab = drv_slab_find(drv, use_flags, chunk_size);
+	if (!slab) {
+		memset(&new_slab, 0, sizeof(new_slab));
+		new_slab.bo = backing;
+		new_slab.use_flags = use_flags;
+		new_slab.chunk_size = chunk_size;
+		new_slab.free_mask = ~0ull;
+
+		slab = drv_array_append(drv->slabs, &new_slab);
+		backing = NULL;
+	}
+	drv_slab_claim(drv, slab, bo);
+	pthread_mutex_unlock(&drv->driver_lock);
+
+	if (backing)
+		drv_bo_destroy(backing);
+
+	return bo;
+
+fail:
+	free(bo);
+	return NULL;
+}
+
+/*
+ * Only buffers that would be linear anyway, or that only the CPU touches, are sub-allocated,
+ * so that a slab never changes the layout a buffer would otherwise get.
+ */
+static bool drv_slab_eligible(struct driver *drv, uint32_t format, uint64_t use_flags)
+{
+	struct combination *combo;
+
+	if (!drv->backend->bo_compute_metadata || (use_flags & DRV_SLAB_EXCLUDED_USE))
+		return false;
+
+	if (!(use_flags & ~BO_USE_SW_MASK))
+		return true;
+
+	combo = drv_get_combination(drv, format, use_flags);
+	return combo && combo->metadata.modifier == DRM_FORMAT_MOD_LINEAR;
+}
+
+struct bo *drv_slab_bo_create(struct driver *drv, uint32_t width, uint32_t height,
+			      uint32_t format, uint64_t use_flags)
+{
+	struct bo *bo;
+	uint64_t start;
+
+	pthread_once(&drv_slab_once, drv_slab_init_once);
+
+	if (!drv_slab_enabled || !drv_slab_eligible(drv, format, use_flags))
+		return NULL;
+
+	DRV_TRACE_BEGIN("drv_slab_bo_create " DRV_TRACE_FOURCC " %ux%u use=0x%llx",
+			DRV_TRACE_FOURCC_ARGS(format), width, height, (unsigned long long)use_flags);
+	start = drv_stats_begin();
+	bo = drv_slab_bo_alloc(drv, width, height, format, use_flags);
+	/* Buffers that don't fit a slab are counted by the regular create that follows. */
+	if (bo)
+		drv_stats_end(DRV_STAT_BO_CREATE, start, 0);
+	DRV_TRACE_END();
+
+	return bo;
+}
+
+void drv_slab_bo_destroy(struct bo *bo)
+{
+	struct driver *drv = bo->drv;
+	struct drv_slab *slab = bo->slab;
+	struct bo *backing = NULL;
+	uint32_t chunk = (bo->meta.offsets[0] / slab->chunk_size);
+	size_t plane;
+	uint32_t i;
+
+	pthread_mutex_lock(&drv->driver_lock);
+
+	for (plane = 0; plane < bo->meta.num_planes; plane++)
+		drv_decrement_reference_count(drv, bo, plane);
+
+	slab->free_mask |= 1ull << chunk;
+
+	/* Keep one empty slab per class around so that create/destroy loops don't thrash. */
+	if (!~slab->free_mask) {
+		for (i = 0; i < drv_array_size(drv->slabs); i++) {
+			struct drv_slab *other = drv_array_at_idx(drv->slabs, i);
+			if (other != slab && other->use_flags == slab->use_flags &&
+			    other->chunk_size == slab->chunk_size && other->free_mask)
+				break;
+		}
+
+		if (i < drv_array_size(drv->slabs)) {
+			backing = slab->bo;
+			for (i = 0; i < drv_array_size(drv->slabs); i++) {
+				if (drv_array_at_idx(drv->slabs, i) == slab) {
+					drv_array_remove(drv->slabs, i);
+					break;
+				}
+			}
+		}
+	}
+
+	pthread_mutex_unlock(&drv->driver_lock);
+
+	if (backing)
+		drv_bo_destroy(backing);
+}
+
+void drv_slab_fini(struct driver *drv)
+{
+	struct drv_slab *slab;
+
+	while (drv_array_size(drv->slabs)) {
+		slab = drv_array_at_idx(drv->slabs, 0);
+		drv_bo_destroy(slab->bo);
+		drv_array_remove(drv->slabs, 0);
+	}
+
+	drv_array_destroy(drv->slabs);
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stdint.h>
+
+#include "drv_priv.h"
+
+/* A backing object split into equal chunks, each holding one small buffer. */
+struct drv_slab {
+	struct bo *bo;
+	uint64_t use_flags;
+	uint32_t chunk_size;
+	/* Bit n set: chunk n is free. */
+	uint64_t free_mask;
+};
+
+/* Returns NULL when the buffer should get an object of its own. */
+struct bo *drv_slab_bo_create(struct driver *drv, uint32_t width, uint32_t height,
+			      uint32_t format, uint64_t use_flags);
+void drv_slab_bo_destroy(struct bo *bo);
+/* Destroys the slabs left at drv_destroy() time, before the backend is closed. */
+void drv_slab_fini(struct driver *drv);
+
+/* The object that actually backs bo, for the backend hooks that work on whole objects. */
+static inline struct bo *drv_slab_backing(struct bo *bo)
+{
+	return bo->slab ? bo->slab->bo : bo;
+}
+
+#endif
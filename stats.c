@@ -0,0 +1,466 @@
+/*
+ * Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Per-operation statistics for the backend hooks.
+ *
+ * Every thread that records a sample gets its own block of counters, so the hot path never
+ * takes a lock or bounces a cache line between threads. Readers walk the list of blocks and
+ * sum them. Blocks of exited threads are folded into a retired block.
+ *
+ * Collection is off by default. MINIGBM_STATS=1 turns it on, MINIGBM_STATS=dump also logs
+ * a report when the process exits.
+ *
+ * Map policy decisions (see map_policy.c) are counted alongside.
+ *
+ * Memory accounting is separate and always on: each driver keeps the live and peak bytes of
+ * its buffers, keyed by format, modifier and use flags. Only the first reference to a kernel
+ * buffer is counted, so importing the same buffer twice does not count it twice.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "drv_priv.h"
+#include "helpers.h"
+#include "stats.h"
+#include "util.h"
+
+/* Bucket i counts samples in [2^i, 2^(i+1)) ns; the last bucket also takes everything above. */
+#define DRV_STATS_NUM_BUCKETS 32
+
+struct drv_stats_hist {
+	uint64_t count;
+	uint64_t errors;
+	uint64_t total_ns;
+	uint64_t max_ns;
+	uint64_t buckets[DRV_STATS_NUM_BUCKETS];
+};
+
+struct drv_stats_counters {
+	struct drv_stats_hist ops[DRV_STAT_NUM_OPS];
+	uint64_t map_cache[DRV_MAP_CACHE_COUNT];
+	uint64_t map_adapted;
+};
+
+struct drv_stats_block {
+	struct drv_stats_counters c;
+	struct drv_stats_block *next;
+};
+
+static const char *drv_stat_op_names[DRV_STAT_NUM_OPS] = {
+	[DRV_STAT_BO_CREATE] = "bo_create",	    [DRV_STAT_BO_IMPORT] = "bo_import",
+	[DRV_STAT_BO_MAP] = "bo_map",		    [DRV_STAT_BO_UNMAP] = "bo_unmap",
+	[DRV_STAT_BO_INVALIDATE] = "bo_invalidate", [DRV_STAT_BO_FLUSH] = "bo_flush",
+};
+
+bool drv_stats_on;
+
+static pthread_once_t drv_stats_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t drv_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t drv_stats_key;
+static struct drv_stats_block *drv_stats_blocks;
+static struct drv_stats_block drv_stats_retired;
+static __thread struct drv_stats_block *drv_stats_tls;
+
+/* Counters are only written by their owning thread, so relaxed accesses are enough. */
+#define STAT_LOAD(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define STAT_STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+#define STAT_ADD(x, v) STAT_STORE(x, STAT_LOAD(x) + (v))
+
+static void drv_stats_merge(struct drv_stats_block *dst, struct drv_stats_block *src)
+{
+	uint32_t op, i;
+
+	for (op = 0; op < DRV_STAT_NUM_OPS; op++) {
+		struct drv_stats_hist *d = &dst->c.ops[op];
+		struct drv_stats_hist *s = &src->c.ops[op];
+
+		d->count += STAT_LOAD(s->count);
+		d->errors += STAT_LOAD(s->errors);
+		d->total_ns += STAT_LOAD(s->total_ns);
+		d->max_ns = MAX(d->max_ns, STAT_LOAD(s->max_ns));
+		for (i = 0; i < DRV_STATS_NUM_BUCKETS; i++)
+			d->buckets[i] += STAT_LOAD(s->buckets[i]);
+	}
+
+	for (i = 0; i < DRV_MAP_CACHE_COUNT; i++)
+		dst->c.map_cache[i] += STAT_LOAD(src->c.map_cache[i]);
+	dst->c.map_adapted += STAT_LOAD(src->c.map_adapted);
+}
+
+static void drv_stats_thread_exit(void *data)
+{
+	struct drv_stats_block *block = data;
+	struct drv_stats_block **prev;
+
+	pthread_mutex_lock(&drv_stats_lock);
+	for (prev = &drv_stats_blocks; *prev; prev = &(*prev)->next) {
+		if (*prev == block) {
+			*prev = block->next;
+			break;
+		}
+	}
+	drv_stats_merge(&drv_stats_retired, block);
+	pthread_mutex_unlock(&drv_stats_lock);
+
+	free(block);
+}
+
+static struct drv_stats_block *drv_stats_thread_block(void)
+{
+	struct drv_stats_block *block;
+
+	block = calloc(1, sizeof(*block));
+	if (!block)
+		return NULL;
+
+	pthread_mutex_lock(&drv_stats_lock);
+	block->next = drv_stats_blocks;
+	drv_stats_blocks = block;
+	pthread_mutex_unlock(&drv_stats_lock);
+
+	pthread_setspecific(drv_stats_key, block);
+	drv_stats_tls = block;
+	return block;
+}
+
+static void drv_stats_log_at_exit(void)
+{
+	char *buf, *line, *save = NULL;
+	int len;
+
+	len = drv_stats_dump(NULL, 0);
+	buf = malloc(len + 1);
+	if (!buf)
+		return;
+
+	drv_stats_dump(buf, len + 1);
+	for (line = strtok_r(buf, "\n", &save); line; line = strtok_r(NULL, "\n", &save))
+		drv_log("%s\n", line);
+
+	free(buf);
+}
+
+static void drv_stats_init_once(void)
+{
+	const char *env = getenv("MINIGBM_STATS");
+
+	pthread_key_create(&drv_stats_key, drv_stats_thread_exit);
+
+	if (!env || !strcmp(env, "0"))
+		return;
+
+	drv_stats_on = true;
+	if (!strcmp(env, "dump"))
+		atexit(drv_stats_log_at_exit);
+}
+
+void drv_stats_init(void)
+{
+	pthread_once(&drv_stats_once, drv_stats_init_once);
+}
+
+void drv_stats_record(enum drv_stat_op op, uint64_t start_ns, int ret)
+{
+	struct drv_stats_block *block = drv_stats_tls;
+	struct drv_stats_hist *hist;
+	uint64_t ns = drv_stats_now_ns() - start_ns;
+	uint32_t bucket;
+
+	if (!block) {
+		block = drv_stats_thread_block();
+		if (!block)
+			return;
+	}
+
+	hist = &block->c.ops[op];
+	bucket = ns ? 63 - __builtin_clzll(ns) : 0;
+	if (bucket >= DRV_STATS_NUM_BUCKETS)
+		bucket = DRV_STATS_NUM_BUCKETS - 1;
+
+	STAT_ADD(hist->count, 1);
+	STAT_ADD(hist->total_ns, ns);
+	STAT_ADD(hist->buckets[bucket], 1);
+	if (ret)
+		STAT_ADD(hist->errors, 1);
+	if (ns > STAT_LOAD(hist->max_ns))
+		STAT_STORE(hist->max_ns, ns);
+}
+
+void drv_stats_map_cache(enum drv_map_cache cache, bool adapted)
+{
+	struct drv_stats_block *block = drv_stats_tls;
+
+	if (__builtin_expect(!drv_stats_on, 1))
+		return;
+
+	if (!block) {
+		block = drv_stats_thread_block();
+		if (!block)
+			return;
+	}
+
+	STAT_ADD(block->c.map_cache[cache], 1);
+	if (adapted)
+		STAT_ADD(block->c.map_adapted, 1);
+}
+
+void drv_stats_set_enabled(bool enabled)
+{
+	drv_stats_init();
+	drv_stats_on = enabled;
+}
+
+void drv_stats_reset(void)
+{
+	struct drv_stats_block *block;
+
+	drv_stats_init();
+
+	pthread_mutex_lock(&drv_stats_lock);
+	for (block = drv_stats_blocks; block; block = block->next)
+		memset(&block->c, 0, sizeof(block->c));
+	memset(&drv_stats_retired, 0, sizeof(drv_stats_retired));
+	pthread_mutex_unlock(&drv_stats_lock);
+}
+
+/* Upper bound of the bucket holding the given percentile. */
+static uint64_t drv_stats_percentile_ns(const struct drv_stats_hist *hist, uint32_t percentile)
+{
+	uint64_t target, seen = 0;
+	uint32_t i;
+
+	if (!hist->count)
+		return 0;
+
+	target = DIV_ROUND_UP(hist->count * percentile, 100);
+	for (i = 0; i < DRV_STATS_NUM_BUCKETS; i++) {
+		seen += hist->buckets[i];
+		if (seen >= target)
+			break;
+	}
+
+	return (i + 1 < DRV_STATS_NUM_BUCKETS) ? (2ull << i) : hist->max_ns;
+}
+
+int drv_stats_dump(char *buf, size_t size)
+{
+	struct drv_stats_block sum, *block;
+	size_t len = 0;
+	uint32_t op;
+	int ret;
+
+	drv_stats_init();
+
+	memset(&sum, 0, sizeof(sum));
+	pthread_mutex_lock(&drv_stats_lock);
+	drv_stats_merge(&sum, &drv_stats_retired);
+	for (block = drv_stats_blocks; block; block = block->next)
+		drv_stats_merge(&sum, block);
+	pthread_mutex_unlock(&drv_stats_lock);
+
+#define STATS_PRINT(...)                                                                           \
+	do {                                                                                       \
+		ret = snprintf(buf ? buf + MIN(len, size) : NULL,                                  \
+			       buf ? size - MIN(len, size) : 0, __VA_ARGS__);                      \
+		if (ret < 0)                                                                       \
+			return -EINVAL;                                                            \
+		len += ret;                                                                        \
+	} while (0)
+
+	STATS_PRINT("minigbm stats (%s)\n", drv_stats_on ? "enabled" : "disabled");
+	STATS_PRINT("%-14s %10s %8s %10s %10s %10s %10s\n", "op", "count", "errors", "avg(us)",
+		    "p50(us)", "p99(us)", "max(us)");
+
+	for (op = 0; op < DRV_STAT_NUM_OPS; op++) {
+		const struct drv_stats_hist *hist = &sum.c.ops[op];
+		double avg_us = hist->count ? hist->total_ns / 1000.0 / hist->count : 0.0;
+
+		STATS_PRINT("%-14s %10llu %8llu %10.2f %10.2f %10.2f %10.2f\n",
+			    drv_stat_op_names[op], (unsigned long long)hist->count,
+			    (unsigned long long)hist->errors, avg_us,
+			    drv_stats_percentile_ns(hist, 50) / 1000.0,
+			    drv_stats_percentile_ns(hist, 99) / 1000.0, hist->max_ns / 1000.0);
+	}
+
+	STATS_PRINT("map caching: default %llu, cached %llu, wc %llu (%llu adapted to access)\n",
+		    (unsigned long long)sum.c.map_cache[DRV_MAP_CACHE_DEFAULT],
+		    (unsigned long long)sum.c.map_cache[DRV_MAP_CACHE_CACHED],
+		    (unsigned long long)sum.c.map_cache[DRV_MAP_CACHE_WC],
+		    (unsigned long long)sum.c.map_adapted);
+
+#undef STATS_PRINT
+
+	return len;
+}
+
+int drv_mem_init(struct driver *drv)
+{
+	drv->mem_usage = drv_array_init(sizeof(struct drv_mem_usage));
+	if (!drv->mem_usage)
+		return -ENOMEM;
+
+	memset(&drv->mem_total, 0, sizeof(drv->mem_total));
+	return 0;
+}
+
+void drv_mem_fini(struct driver *drv)
+{
+	drv_array_destroy(drv->mem_usage);
+	drv->mem_usage = NULL;
+}
+
+/* Size of the buffer with tightly packed planes, i.e. what the caller actually asked for. */
+static uint64_t drv_mem_unpadded_size(const struct bo *bo)
+{
+	uint32_t format = bo->meta.format;
+	size_t plane, num_planes = drv_num_planes_from_format(format);
+	uint64_t size = 0;
+
+	for (plane = 0; plane < num_planes; plane++) {
+		uint32_t stride = drv_stride_from_format(format, bo->meta.width, plane);
+		size += drv_size_from_format(format, stride, bo->meta.height, plane);
+	}
+
+	return size;
+}
+
+static void drv_mem_update(struct drv_mem_usage *usage, uint64_t size, uint64_t padding, bool add)
+{
+	if (add) {
+		usage->count++;
+		usage->live_bytes += size;
+		usage->padding_bytes += padding;
+		usage->peak_bytes = MAX(usage->peak_bytes, usage->live_bytes);
+	} else {
+		/*
+		 * The last reference may be an import that sized the buffer differently from
+		 * the one that was counted, so never let the counters wrap.
+		 */
+		usage->count -= MIN(usage->count, 1);
+		usage->live_bytes -= MIN(usage->live_bytes, size);
+		usage->padding_bytes -= MIN(usage->padding_bytes, padding);
+	}
+}
+
+void drv_mem_account(struct bo *bo, bool add)
+{
+	struct driver *drv = bo->drv;
+	struct drv_mem_usage *usage = NULL;
+	uint64_t size = bo->meta.total_size;
+	uint64_t unpadded = drv_mem_unpadded_size(bo);
+	uint64_t padding = (unpadded && unpadded < size) ? size - unpadded : 0;
+	uint32_t i;
+
+	pthread_mutex_lock(&drv->driver_lock);
+
+	for (i = 0; i < drv_array_size(drv->mem_usage); i++) {
+		struct drv_mem_usage *entry = drv_array_at_idx(drv->mem_usage, i);
+		if (entry->format == bo->meta.format &&
+		    entry->modifier == bo->meta.format_modifiers[0] &&
+		    entry->use_flags == bo->meta.use_flags && entry->slab == bo->is_slab_backing) {
+			usage = entry;
+			break;
+		}
+	}
+
+	if (!usage && add) {
+		struct drv_mem_usage entry;
+
+		memset(&entry, 0, sizeof(entry));
+		entry.format = bo->meta.format;
+		entry.modifier = bo->meta.format_modifiers[0];
+		entry.use_flags = bo->meta.use_flags;
+		entry.slab = bo->is_slab_backing;
+		usage = drv_array_append(drv->mem_usage, &entry);
+	}
+
+	/* Entries are kept once created so that their peak survives. */
+	if (usage)
+		drv_mem_update(usage, size, padding, add);
+	drv_mem_update(&drv->mem_total, size, padding, add);
+
+	pthread_mutex_unlock(&drv->driver_lock);
+}
+
+int drv_mem_usage_get(struct driver *drv, struct drv_mem_usage *total, struct drv_mem_usage *usage,
+		      uint32_t max)
+{
+	uint32_t i, count;
+
+	pthread_mutex_lock(&drv->driver_lock);
+
+	if (total)
+		*total = drv->mem_total;
+
+	count = drv_array_size(drv->mem_usage);
+	for (i = 0; usage && i < MIN(count, max); i++)
+		usage[i] = *(struct drv_mem_usage *)drv_array_at_idx(drv->mem_usage, i);
+
+	pthread_mutex_unlock(&drv->driver_lock);
+
+	return count;
+}
+
+int drv_mem_dump(struct driver *drv, char *buf, size_t size)
+{
+	struct drv_mem_usage total, *usage;
+	size_t len = 0;
+	int ret, count, i;
+
+	count = drv_mem_usage_get(drv, &total, NULL, 0);
+	usage = calloc(MAX(count, 1), sizeof(*usage));
+	if (!usage)
+		return -ENOMEM;
+
+	/* Entries are never removed, but more may have been added since the first call. */
+	count = MIN(count, drv_mem_usage_get(drv, &total, usage, count));
+
+#define MEM_PRINT(...)                                                                             \
+	do {                                                                                       \
+		ret = snprintf(buf ? buf + MIN(len, size) : NULL,                                  \
+			       buf ? size - MIN(len, size) : 0, __VA_ARGS__);                      \
+		if (ret < 0)                                                                       \
+			goto out;                                                                  \
+		len += ret;                                                                        \
+	} while (0)
+
+	MEM_PRINT("minigbm memory (%s, fd %d)\n", drv->backend->name, drv->fd);
+	MEM_PRINT("total: %llu buffers, live %llu KiB, peak %llu KiB, padding %llu KiB\n",
+		  (unsigned long long)total.count, (unsigned long long)total.live_bytes / 1024,
+		  (unsigned long long)total.peak_bytes / 1024,
+		  (unsigned long long)total.padding_bytes / 1024);
+	MEM_PRINT("%-6s %-18s %-18s %8s %12s %12s %12s\n", "format", "modifier", "use_flags",
+		  "count", "live(KiB)", "peak(KiB)", "pad(KiB)");
+
+	for (i = 0; i < count; i++) {
+		char fourcc[5];
+
+		if (usage[i].slab) {
+			strcpy(fourcc, "slab");
+		} else {
+			memcpy(fourcc, &usage[i].format, 4);
+			fourcc[4] = '\0';
+		}
+		MEM_PRINT("%-6s 0x%016llx 0x%016llx %8llu %12llu %12llu %12llu\n", fourcc,
+			  (unsigned long long)usage[i].modifier,
+			  (unsigned long long)usage[i].use_flags, (unsigned long long)usage[i].count,
+			  (unsigned long long)usage[i].live_bytes / 1024,
+			  (unsigned long long)usage[i].peak_bytes / 1024,
+			  (unsigned long long)usage[i].padding_bytes / 1024);
+	}
+
+#undef MEM_PRINT
+
+	ret = len;
+out:
+	free(usage);
+	return (ret < 0) ? -EINVAL : ret;
+}
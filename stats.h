@@ -0,0 +1,70 @@
+/*
+ * Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "drv.h"
+
+enum drv_stat_op {
+	DRV_STAT_BO_CREATE,
+	DRV_STAT_BO_IMPORT,
+	DRV_STAT_BO_MAP,
+	DRV_STAT_BO_UNMAP,
+	DRV_STAT_BO_INVALIDATE,
+	DRV_STAT_BO_FLUSH,
+	DRV_STAT_NUM_OPS,
+};
+
+extern bool drv_stats_on;
+
+struct bo;
+struct driver;
+
+void drv_stats_init(void);
+void drv_stats_record(enum drv_stat_op op, uint64_t start_ns, int ret);
+/* Counts a map policy decision; adapted is set when the access profile overrode the flags. */
+void drv_stats_map_cache(enum drv_map_cache cache, bool adapted);
+
+int drv_mem_init(struct driver *drv);
+void drv_mem_fini(struct driver *drv);
+/* Adds or removes a buffer from the memory accounting. Takes drv->driver_lock. */
+void drv_mem_account(struct bo *bo, bool add);
+
+static inline uint64_t drv_stats_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * Timing a backend hook costs a single well predicted branch when stats are disabled:
+ *
+ *	uint64_t start = drv_stats_begin();
+ *	ret = drv->backend->bo_map(...);
+ *	drv_stats_end(DRV_STAT_BO_MAP, start, ret);
+ */
+static inline uint64_t drv_stats_begin(void)
+{
+	if (__builtin_expect(!drv_stats_on, 1))
+		return 0;
+
+	return drv_stats_now_ns();
+}
+
+static inline void drv_stats_end(enum drv_stat_op op, uint64_t start_ns, int ret)
+{
+	if (__builtin_expect(start_ns != 0, 0))
+		drv_stats_record(op, start_ns, ret);
+}
+
+#endif
@@ -0,0 +1,338 @@
+/*
+ * Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Software-only backend. Buffers are backed by sealed memfds and, when /dev/udmabuf is
+ * available, exported as real dma-bufs so they can still be shared with other processes and
+ * devices. No DRM device is needed, which makes this backend usable on GPU-less machines and
+ * for benchmarking the rest of minigbm in CI.
+ *
+ * A bo handle is the memfd (or imported fd) itself.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/falloc.h>
+#include <linux/memfd.h>
+#include <linux/udmabuf.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <xf86drm.h>
+
+#include "drv_priv.h"
+#include "helpers.h"
+#include "util.h"
+
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS 1033
+#endif
+
+#ifndef F_SEAL_SHRINK
+#define F_SEAL_SHRINK 0x0002
+#endif
+
+#define SW_STRIDE_ALIGN 64
+#define SW_UDMABUF_PATH "/dev/udmabuf"
+
+static const uint32_t render_target_formats[] = {
+	DRM_FORMAT_ABGR16161616F, DRM_FORMAT_ABGR2101010, DRM_FORMAT_ABGR8888,
+	DRM_FORMAT_ARGB2101010,	  DRM_FORMAT_ARGB8888,	  DRM_FORMAT_BGR888,
+	DRM_FORMAT_RGB565,	  DRM_FORMAT_XBGR2101010, DRM_FORMAT_XBGR8888,
+	DRM_FORMAT_XRGB2101010,	  DRM_FORMAT_XRGB8888
+};
+
+static const uint32_t texture_source_formats[] = {
+	DRM_FORMAT_GR88,	DRM_FORMAT_NV12, DRM_FORMAT_NV21, DRM_FORMAT_P010,
+	DRM_FORMAT_R16,		DRM_FORMAT_R8,	 DRM_FORMAT_UYVY, DRM_FORMAT_YUYV,
+	DRM_FORMAT_YVU420,	DRM_FORMAT_YVU420_ANDROID
+};
+
+struct sw_device {
+	int udmabuf_fd;
+};
+
+struct sw_bo {
+	int dmabuf_fd;
+	bool purged;
+};
+
+static int sw_memfd_create(const char *name, unsigned int flags)
+{
+	return syscall(__NR_memfd_create, name, flags);
+}
+
+static int sw_init(struct driver *drv)
+{
+	struct sw_device *sw;
+	uint64_t use_flags = (BO_USE_RENDER_MASK | BO_USE_NON_GPU_HW | BO_USE_CURSOR) &
+			     ~BO_USE_PROTECTED;
+
+	sw = calloc(1, sizeof(*sw));
+	if (!sw)
+		return -ENOMEM;
+
+	/* udmabuf is optional; without it buffers are shared as plain memfds. */
+	sw->udmabuf_fd = open(SW_UDMABUF_PATH, O_RDWR | O_CLOEXEC);
+	drv->priv = sw;
+
+	/* Every buffer is plain memory, so every linear combination is available. */
+	drv_add_combinations(drv, render_target_formats, ARRAY_SIZE(render_target_formats),
+			     &LINEAR_METADATA, use_flags);
+	drv_add_combinations(drv, texture_source_formats, ARRAY_SIZE(texture_source_formats),
+			     &LINEAR_METADATA, use_flags);
+
+	return 0;
+}
+
+static void sw_close(struct driver *drv)
+{
+	struct sw_device *sw = drv->priv;
+
+	if (sw->udmabuf_fd >= 0)
+		close(sw->udmabuf_fd);
+
+	free(sw);
+	drv->priv = NULL;
+}
+
+static int sw_bo_compute_metadata(struct bo *bo, uint32_t width, uint32_t height, uint32_t format,
+				  uint64_t use_flags, const uint64_t *modifiers, uint32_t count)
+{
+	uint32_t stride, aligned_height;
+	size_t plane;
+
+	if (modifiers && !drv_has_modifier(modifiers, count, DRM_FORMAT_MOD_LINEAR))
+		return -EINVAL;
+
+	aligned_height = height;
+	if (format == DRM_FORMAT_YVU420_ANDROID) {
+		/* HAL_PIXEL_FORMAT_YV12 wants 16 byte aligned chroma strides. */
+		stride = drv_stride_from_format(format, ALIGN(width, 32), 0);
+	} else {
+		stride = drv_stride_from_format(format, width, 0);
+		stride = ALIGN(stride, SW_STRIDE_ALIGN);
+	}
+
+	drv_bo_from_format(bo, stride, aligned_height, format);
+
+	bo->meta.tiling = 0;
+	for (plane = 0; plane < bo->meta.num_planes; plane++)
+		bo->meta.format_modifiers[plane] = DRM_FORMAT_MOD_LINEAR;
+
+	/* udmabuf and memfd sealing both work on whole pages. */
+	bo->meta.total_size = ALIGN(bo->meta.total_size, getpagesize());
+	return 0;
+}
+
+static int sw_bo_create_from_metadata(struct bo *bo)
+{
+	struct sw_device *sw = bo->drv->priv;
+	struct sw_bo *priv;
+	int ret, memfd;
+	size_t plane;
+
+	priv = calloc(1, sizeof(*priv));
+	if (!priv)
+		return -ENOMEM;
+
+	priv->dmabuf_fd = -1;
+
+	memfd = sw_memfd_create("minigbm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (memfd < 0) {
+		drv_log("memfd_create failed: %s\n", strerror(errno));
+		free(priv);
+		return -errno;
+	}
+
+	if (ftruncate(memfd, bo->meta.total_size)) {
+		ret = -errno;
+		drv_log("ftruncate failed: %s\n", strerror(errno));
+		goto fail;
+	}
+
+	/* udmabuf refuses memfds that could shrink underneath the dma-buf. */
+	if (fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK)) {
+		ret = -errno;
+		drv_log("F_ADD_SEALS failed: %s\n", strerror(errno));
+		goto fail;
+	}
+
+	if (sw->udmabuf_fd >= 0) {
+		struct udmabuf_create create;
+
+		memset(&create, 0, sizeof(create));
+		create.memfd = memfd;
+		create.flags = UDMABUF_FLAGS_CLOEXEC;
+		create.offset = 0;
+		create.size = bo->meta.total_size;
+
+		priv->dmabuf_fd = ioctl(sw->udmabuf_fd, UDMABUF_CREATE, &create);
+		if (priv->dmabuf_fd < 0)
+			drv_log("UDMABUF_CREATE failed: %s\n", strerror(errno));
+	}
+
+	for (plane = 0; plane < bo->meta.num_planes; plane++)
+		bo->handles[plane].u32 = memfd;
+
+	bo->priv = priv;
+	return 0;
+
+fail:
+	close(memfd);
+	free(priv);
+	return ret;
+}
+
+static int sw_bo_destroy(struct bo *bo)
+{
+	struct sw_bo *priv = bo->priv;
+	size_t plane, p;
+
+	for (plane = 0; plane < bo->meta.num_planes; plane++) {
+		for (p = 0; p < plane; p++)
+			if (bo->handles[p].u32 == bo->handles[plane].u32)
+				break;
+
+		if (p == plane)
+			close(bo->handles[plane].u32);
+	}
+
+	if (priv) {
+		if (priv->dmabuf_fd >= 0)
+			close(priv->dmabuf_fd);
+		free(priv);
+		bo->priv = NULL;
+	}
+
+	return 0;
+}
+
+static int sw_bo_import(struct bo *bo, struct drv_import_fd_data *data)
+{
+	size_t plane, p;
+	struct stat st;
+	uint64_t end;
+	int fd;
+
+	/*
+	 * Handles come from other processes, so check that every plane has at least its minimum
+	 * pitch and lies within its fd before mappings are built on them.
+	 */
+	for (plane = 0; plane < bo->meta.num_planes; plane++) {
+		end = (uint64_t)data->offsets[plane] +
+		      (uint64_t)data->strides[plane] *
+			  drv_height_from_format(data->format, data->height, plane);
+
+		if (data->strides[plane] <
+			drv_stride_from_format(data->format, data->width, plane) ||
+		    fstat(data->fds[plane], &st) || end > (uint64_t)st.st_size) {
+			drv_log("Import layout exceeds fd %d.\n", data->fds[plane]);
+			return -EINVAL;
+		}
+	}
+
+	for (plane = 0; plane < bo->meta.num_planes; plane++) {
+		for (p = 0; p < plane; p++)
+			if (data->fds[p] == data->fds[plane])
+				break;
+
+		if (p < plane) {
+			bo->handles[plane].u32 = bo->handles[p].u32;
+			continue;
+		}
+
+		fd = fcntl(data->fds[plane], F_DUPFD_CLOEXEC, 0);
+		if (fd < 0) {
+			drv_log("F_DUPFD_CLOEXEC failed (fd=%d)\n", data->fds[plane]);
+			bo->meta.num_planes = plane;
+			sw_bo_destroy(bo);
+			return -errno;
+		}
+
+		bo->handles[plane].u32 = fd;
+	}
+
+	return 0;
+}
+
+/*
+ * There is no lazy way to hand memfd pages to the kernel, so purgeable buffers drop them right
+ * away. Only for buffers we allocated, and not when udmabuf pins the pages anyway.
+ */
+static int sw_bo_madvise(struct bo *bo, bool purgeable)
+{
+	struct sw_bo *priv = bo->priv;
+	bool purged;
+
+	if (!priv || priv->dmabuf_fd >= 0)
+		return 0;
+
+	if (!purgeable) {
+		/* Reported once: from here on the buffer is in use again, on fresh zeroed pages. */
+		purged = priv->purged;
+		priv->purged = false;
+		return purged;
+	}
+
+	if (!priv->purged) {
+		if (fallocate(bo->handles[0].u32, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 0,
+			      bo->meta.total_size)) {
+			drv_log("FALLOC_FL_PUNCH_HOLE failed: %s\n", strerror(errno));
+			return -errno;
+		}
+		priv->purged = true;
+	}
+
+	return priv->purged;
+}
+
+static int sw_bo_get_plane_fd(struct bo *bo, size_t plane)
+{
+	struct sw_bo *priv = bo->priv;
+	int fd;
+
+	if (priv && priv->dmabuf_fd >= 0)
+		fd = fcntl(priv->dmabuf_fd, F_DUPFD_CLOEXEC, 0);
+	else
+		fd = fcntl(bo->handles[plane].u32, F_DUPFD_CLOEXEC, 0);
+
+	return (fd < 0) ? -errno : fd;
+}
+
+static uint32_t sw_resolve_format(struct driver *drv, uint32_t format, uint64_t use_flags)
+{
+	switch (format) {
+	case DRM_FORMAT_FLEX_IMPLEMENTATION_DEFINED:
+		/* Camera subsystem requires NV12. */
+		if (use_flags & (BO_USE_CAMERA_READ | BO_USE_CAMERA_WRITE))
+			return DRM_FORMAT_NV12;
+		/*HACK: See b/28671744 */
+		return DRM_FORMAT_XBGR8888;
+	case DRM_FORMAT_FLEX_YCbCr_420_888:
+		return DRM_FORMAT_YVU420_ANDROID;
+	default:
+		return format;
+	}
+}
+
+const struct backend backend_sw = {
+	.name = "sw",
+	.init = sw_init,
+	.close = sw_close,
+	.bo_compute_metadata = sw_bo_compute_metadata,
+	.bo_create_from_metadata = sw_bo_create_from_metadata,
+	.bo_destroy = sw_bo_destroy,
+	.bo_import = sw_bo_import,
+	DRV_DMABUF_MAP_FUNCS,
+	.bo_get_plane_fd = sw_bo_get_plane_fd,
+	.bo_madvise = sw_bo_madvise,
+	.resolve_format = sw_resolve_format,
+};
@@ -0,0 +1,349 @@
+/*
+ * Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Unit tests for the parts of minigbm that can run without a GPU. Tests that need a driver get
+ * the software backend.
+ *
+ * usage: minigbm_test [test_name|all]
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <xf86drm.h>
+
+#ifdef DRV_I915
+#include <i915_drm.h>
+#endif
+
+#include "../drv.h"
+#ifdef DRV_I915
+#include "../i915_device_info.h"
+#endif
+#include "../util.h"
+
+#define CHECK(cond)                                                                                \
+	do {                                                                                       \
+		if (!(cond)) {                                                                     \
+			fprintf(stderr, "[  FAILED  ] check in %s() %s:%d\n", __func__, __FILE__,  \
+				__LINE__);                                                         \
+			return 0;                                                                  \
+		}                                                                                  \
+	} while (0)
+
+struct minigbm_test_context {
+	struct driver *drv;
+};
+
+struct minigbm_testcase {
+	const char *name;
+	int (*run_test)(struct minigbm_test_context *ctx);
+};
+
+#ifdef DRV_I915
+static int check_align(const struct i915_device_info *info, uint32_t tiling, uint32_t stride,
+		       uint32_t height, uint32_t expected_stride, uint32_t expected_height)
+{
+	CHECK(i915_device_info_align(info, tiling, true, &stride, &height) == 0);
+	CHECK(stride == expected_stride);
+	CHECK(height == expected_height);
+	return 1;
+}
+
+/*
+ * Checks the PCI id lookup and the layouts derived from it.
+ */
+static int test_i915_device_info(struct minigbm_test_context *ctx)
+{
+	const struct i915_device_info *info;
+	uint32_t stride, height;
+
+	/* Gen3 strides are powers of two and limited to 8 KiB. */
+	info = i915_get_device_info(0x2582);
+	CHECK(info->gen == 3);
+	CHECK(check_align(info, I915_TILING_Y, 1000, 10, 1024, 16));
+	stride = 9000;
+	height = 1;
+	CHECK(i915_device_info_align(info, I915_TILING_X, true, &stride, &height) == -EINVAL);
+
+	/* SKL goes by family, BXT by exact id. Only the big cores have an LLC. */
+	info = i915_get_device_info(0x1912);
+	CHECK(info->gen == 9);
+	CHECK(info->has_llc && info->has_ccs);
+	info = i915_get_device_info(0x5A84);
+	CHECK(info->gen == 9);
+	CHECK(!info->has_llc && info->has_ccs);
+	CHECK(check_align(info, I915_TILING_NONE, 100, 3, 128, 4));
+	CHECK(check_align(info, I915_TILING_X, 100, 3, 512, 8));
+	CHECK(check_align(info, I915_TILING_Y, 100, 33, 128, 64));
+
+	/* Natural strides are kept when asked to, only the height is aligned. */
+	stride = 100;
+	height = 3;
+	CHECK(i915_device_info_align(info, I915_TILING_Y, false, &stride, &height) == 0);
+	CHECK(stride == 100 && height == 32);
+
+	info = i915_get_device_info(0x8A52);
+	CHECK(info->gen == 11);
+	info = i915_get_device_info(0x4E61);
+	CHECK(info->gen == 11 && !info->has_llc);
+
+	/* Gen12 keeps Y but drops Yf and the gen9 CCS layout. */
+	info = i915_get_device_info(0x46A6);
+	CHECK(info->gen == 12 && info->has_llc && !info->has_ccs);
+	CHECK(info->has_fences && info->has_y_tiling && !info->has_yf_tiling && !info->has_tile4);
+	CHECK(i915_get_device_info(0x9A49)->gen == 12);
+	CHECK(i915_get_device_info(0x4C8A)->gen == 12);
+	CHECK(i915_get_device_info(0xA7A0)->gen == 12);
+	CHECK(!i915_get_device_info(0x4905)->has_llc);
+
+	/* DG2 and MTL trade Y for Tile4 and have no fences. */
+	info = i915_get_device_info(0x56A0);
+	CHECK(info->gen == 12 && !info->has_llc && !info->has_fences);
+	CHECK(!info->has_y_tiling && info->has_tile4);
+	CHECK(check_align(info, I915_TILING_4, 100, 33, 128, 64));
+	CHECK(i915_get_device_info(0x7D55)->has_tile4);
+
+	CHECK(i915_get_device_info(0x1912)->has_yf_tiling);
+
+	info = i915_get_device_info(0xFFFF);
+	CHECK(info->gen == 4);
+	CHECK(!info->has_ccs);
+	CHECK(check_align(info, I915_NUM_TILING_MODES, 100, 3, 128, 4));
+
+	return 1;
+}
+#endif
+
+/* Writes a pattern through one mapping and reads it back through a second one. */
+static int check_map_cycle(struct driver *drv)
+{
+	struct rectangle rect = { 0, 0, 64, 64 };
+	struct mapping *mapping;
+	uint32_t *addr;
+	uint32_t stride, x, y;
+	struct bo *bo;
+
+	bo = drv_bo_create(drv, rect.width, rect.height, DRM_FORMAT_ARGB8888,
+			   BO_USE_SW_READ_OFTEN | BO_USE_SW_WRITE_OFTEN);
+	CHECK(bo);
+	stride = drv_bo_get_plane_stride(bo, 0) / sizeof(*addr);
+
+	addr = drv_bo_map(bo, &rect, BO_MAP_WRITE, &mapping, 0);
+	CHECK(addr != MAP_FAILED);
+	for (y = 0; y < rect.height; y++)
+		for (x = 0; x < rect.width; x++)
+			addr[y * stride + x] = y << 16 | x;
+	CHECK(drv_bo_flush_or_unmap(bo, mapping) == 0);
+
+	/* A second lock of the same mapping has to be bracketed again. */
+	addr = drv_bo_map(bo, &rect, BO_MAP_READ_WRITE, &mapping, 0);
+	CHECK(addr != MAP_FAILED);
+	CHECK(drv_bo_invalidate(bo, mapping) == 0);
+	for (y = 0; y < rect.height; y++)
+		for (x = 0; x < rect.width; x++)
+			CHECK(addr[y * stride + x] == (y << 16 | x));
+	CHECK(drv_bo_flush_or_unmap(bo, mapping) == 0);
+
+	drv_bo_destroy(bo);
+	return 1;
+}
+
+static struct driver *test_open_vgem(void)
+{
+	struct driver *drv = NULL;
+	drmVersionPtr version;
+	char path[32];
+	int i, fd;
+
+	for (i = 0; i < 16 && !drv; i++) {
+		snprintf(path, sizeof(path), "/dev/dri/card%d", i);
+		fd = open(path, O_RDWR | O_CLOEXEC);
+		if (fd < 0)
+			continue;
+
+		version = drmGetVersion(fd);
+		if (version && !strcmp(version->name, "vgem"))
+			drv = drv_create(fd);
+		drmFreeVersion(version);
+
+		if (drv && drv_init(drv, 0)) {
+			drv_destroy(drv);
+			drv = NULL;
+		}
+
+		if (!drv)
+			close(fd);
+	}
+
+	return drv;
+}
+
+/*
+ * Maps through dma-bufs: udmabuf exports on the software backend (plain memfds without it)
+ * and vgem when it is loaded. Every lock must be bracketed by one SYNC_START and SYNC_END.
+ */
+static int test_dmabuf_map(struct minigbm_test_context *ctx)
+{
+	struct driver *vgem;
+	int fd, ret;
+
+	if (access("/dev/udmabuf", F_OK))
+		printf("[   INFO   ] no udmabuf, the software backend maps plain memfds\n");
+	CHECK(check_map_cycle(ctx->drv));
+
+	vgem = test_open_vgem();
+	if (!vgem) {
+		printf("[   INFO   ] vgem is not loaded\n");
+		return 1;
+	}
+
+	ret = check_map_cycle(vgem);
+	fd = drv_get_fd(vgem);
+	drv_destroy(vgem);
+	close(fd);
+	return ret;
+}
+
+/*
+ * The software backend drops the pages of purgeable buffers right away, unless udmabuf pins
+ * them. Either way reclaim reports every purge exactly once.
+ */
+static int test_purgeable(struct minigbm_test_context *ctx)
+{
+	struct rectangle rect = { 0, 0, 64, 64 };
+	int purges = access("/dev/udmabuf", F_OK) ? 1 : 0;
+	struct mapping *mapping;
+	uint8_t *addr;
+	struct bo *bo;
+	int cycle;
+
+	bo = drv_bo_create(ctx->drv, rect.width, rect.height, DRM_FORMAT_R8,
+			   BO_USE_SW_READ_OFTEN | BO_USE_SW_WRITE_OFTEN);
+	CHECK(bo);
+
+	/* Never made purgeable, so nothing was lost. */
+	CHECK(drv_bo_reclaim(bo) == 0);
+
+	for (cycle = 0; cycle < 2; cycle++) {
+		addr = drv_bo_map(bo, &rect, BO_MAP_READ_WRITE, &mapping, 0);
+		CHECK(addr != MAP_FAILED);
+		addr[0] = 0xA5;
+		CHECK(drv_bo_flush_or_unmap(bo, mapping) == 0);
+		CHECK(drv_bo_unmap(bo, mapping) == 0);
+
+		CHECK(drv_bo_set_purgeable(bo) == 0);
+		CHECK(drv_bo_reclaim(bo) == purges);
+		CHECK(drv_bo_reclaim(bo) == 0);
+
+		addr = drv_bo_map(bo, &rect, BO_MAP_READ, &mapping, 0);
+		CHECK(addr != MAP_FAILED);
+		CHECK(addr[0] == (purges ? 0 : 0xA5));
+		CHECK(drv_bo_flush_or_unmap(bo, mapping) == 0);
+		CHECK(drv_bo_unmap(bo, mapping) == 0);
+	}
+
+	drv_bo_destroy(bo);
+	return 1;
+}
+
+// clang-format off
+static const struct minigbm_testcase tests[] = {
+	{ "dmabuf_map", test_dmabuf_map },
+	{ "purgeable", test_purgeable },
+#ifdef DRV_I915
+	{ "i915_device_info", test_i915_device_info },
+#endif
+};
+// clang-format on
+
+static struct minigbm_test_context *test_init_driver(void)
+{
+	struct minigbm_test_context *ctx;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (!ctx)
+		return NULL;
+
+	ctx->drv = drv_create(-1);
+	if (!ctx->drv) {
+		free(ctx);
+		return NULL;
+	}
+
+	if (drv_init(ctx->drv, 0)) {
+		drv_destroy(ctx->drv);
+		free(ctx);
+		return NULL;
+	}
+
+	return ctx;
+}
+
+static void test_close_driver(struct minigbm_test_context *ctx)
+{
+	drv_destroy(ctx->drv);
+	free(ctx);
+}
+
+static void print_help(const char *argv0)
+{
+	uint32_t i;
+	printf("usage: %s [test_name]\n\n", argv0);
+	printf("A valid name test is one the following:\n");
+	printf("all\n");
+	for (i = 0; i < ARRAY_SIZE(tests); i++)
+		printf("%s\n", tests[i].name);
+}
+
+int main(int argc, char *argv[])
+{
+	struct minigbm_test_context *ctx;
+	const char *name = argc == 2 ? argv[1] : "all";
+	uint32_t i, num_run = 0;
+	int ret = 0;
+
+	setbuf(stdout, NULL);
+	if (argc > 2)
+		goto print_usage;
+
+	ctx = test_init_driver();
+	if (!ctx) {
+		fprintf(stderr, "[  FAILED  ] to initialize the software backend.\n");
+		return 1;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(tests); i++) {
+		if (strcmp(tests[i].name, name) && strcmp("all", name))
+			continue;
+
+		printf("[ RUN      ] minigbm_test.%s\n", tests[i].name);
+		if (!tests[i].run_test(ctx)) {
+			fprintf(stderr, "[  FAILED  ] minigbm_test.%s\n", tests[i].name);
+			ret |= 1;
+		} else {
+			printf("[  PASSED  ] minigbm_test.%s\n", tests[i].name);
+		}
+
+		num_run++;
+	}
+
+	test_close_driver(ctx);
+
+	if (!num_run && strcmp("all", name))
+		goto print_usage;
+
+	return ret;
+
+print_usage:
+	print_help(argv[0]);
+	return 1;
+}
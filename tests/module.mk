@@ -0,0 +1,8 @@
+# Copyright 2021 The Chromium OS Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+
+include common.mk
+
+CC_BINARY(tests/minigbm_test): LDLIBS += -lpthread
+CC_BINARY(tests/minigbm_test): $(tests_C_OBJECTS) $(C_OBJECTS)
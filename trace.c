@@ -0,0 +1,118 @@
+/*
+ * Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifdef USE_TRACE
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#ifdef __ANDROID__
+#define ATRACE_TAG ATRACE_TAG_GRAPHICS
+#include <cutils/trace.h>
+#endif
+
+#include "trace.h"
+
+#define DRV_TRACE_MAX_LEN 256
+
+#ifdef __ANDROID__
+
+bool drv_trace_enabled(void)
+{
+	return ATRACE_ENABLED();
+}
+
+void drv_trace_begin(const char *format, ...)
+{
+	char buf[DRV_TRACE_MAX_LEN];
+	va_list args;
+
+	va_start(args, format);
+	vsnprintf(buf, sizeof(buf), format, args);
+	va_end(args);
+
+	ATRACE_BEGIN(buf);
+}
+
+void drv_trace_end(void)
+{
+	ATRACE_END();
+}
+
+void drv_trace_counter(const char *name, int64_t value)
+{
+	ATRACE_INT64(name, value);
+}
+
+#else
+
+static pthread_once_t drv_trace_once = PTHREAD_ONCE_INIT;
+static int drv_trace_fd = -1;
+
+static void drv_trace_open(void)
+{
+	static const char *const paths[] = {
+		"/sys/kernel/tracing/trace_marker",
+		"/sys/kernel/debug/tracing/trace_marker",
+	};
+	size_t i;
+
+	for (i = 0; i < sizeof(paths) / sizeof(paths[0]) && drv_trace_fd < 0; i++)
+		drv_trace_fd = open(paths[i], O_WRONLY | O_CLOEXEC);
+}
+
+bool drv_trace_enabled(void)
+{
+	pthread_once(&drv_trace_once, drv_trace_open);
+	return drv_trace_fd >= 0;
+}
+
+/* Same "B|pid|name", "E|pid" and "C|pid|name|value" lines atrace writes, so tools parse both. */
+void drv_trace_begin(const char *format, ...)
+{
+	char buf[DRV_TRACE_MAX_LEN];
+	va_list args;
+	int len;
+
+	len = snprintf(buf, sizeof(buf), "B|%d|", getpid());
+	va_start(args, format);
+	len += vsnprintf(buf + len, sizeof(buf) - len, format, args);
+	va_end(args);
+
+	if (len >= (int)sizeof(buf))
+		len = sizeof(buf) - 1;
+
+	if (write(drv_trace_fd, buf, len) < 0)
+		return;
+}
+
+void drv_trace_end(void)
+{
+	char buf[32];
+	int len = snprintf(buf, sizeof(buf), "E|%d", getpid());
+
+	if (write(drv_trace_fd, buf, len) < 0)
+		return;
+}
+
+void drv_trace_counter(const char *name, int64_t value)
+{
+	char buf[DRV_TRACE_MAX_LEN];
+	int len = snprintf(buf, sizeof(buf), "C|%d|%s|%lld", getpid(), name, (long long)value);
+
+	if (len >= (int)sizeof(buf))
+		len = sizeof(buf) - 1;
+
+	if (write(drv_trace_fd, buf, len) < 0)
+		return;
+}
+
+#endif
+
+#endif
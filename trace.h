@@ -0,0 +1,72 @@
+/*
+ * Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+/*
+ * Trace spans for system profilers. Spans go to atrace on Android and to the ftrace
+ * trace_marker elsewhere. Without USE_TRACE every macro below expands to nothing, so neither
+ * the calls nor their arguments are compiled in.
+ */
+
+#ifdef USE_TRACE
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+bool drv_trace_enabled(void);
+__attribute__((format(printf, 1, 2))) void drv_trace_begin(const char *format, ...);
+void drv_trace_end(void);
+void drv_trace_counter(const char *name, int64_t value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define DRV_TRACE_BEGIN(...)                                                                       \
+	do {                                                                                       \
+		if (drv_trace_enabled())                                                           \
+			drv_trace_begin(__VA_ARGS__);                                              \
+	} while (0)
+
+#define DRV_TRACE_END()                                                                            \
+	do {                                                                                       \
+		if (drv_trace_enabled())                                                           \
+			drv_trace_end();                                                           \
+	} while (0)
+
+#define DRV_TRACE_COUNTER(name, value)                                                             \
+	do {                                                                                       \
+		if (drv_trace_enabled())                                                           \
+			drv_trace_counter(name, value);                                            \
+	} while (0)
+
+/* Prints a fourcc, e.g. DRV_TRACE_BEGIN("create " DRV_TRACE_FOURCC, DRV_TRACE_FOURCC_ARGS(f)). */
+#define DRV_TRACE_FOURCC "%c%c%c%c"
+#define DRV_TRACE_FOURCC_ARGS(f)                                                                   \
+	(char)((f)&0xff), (char)(((f) >> 8) & 0xff), (char)(((f) >> 16) & 0xff),                  \
+	    (char)(((f) >> 24) & 0xff)
+
+#else
+
+#define DRV_TRACE_BEGIN(...)                                                                       \
+	do {                                                                                       \
+	} while (0)
+#define DRV_TRACE_END()                                                                            \
+	do {                                                                                       \
+	} while (0)
+#define DRV_TRACE_COUNTER(name, value)                                                             \
+	do {                                                                                       \
+	} while (0)
+
+#endif
+
+#endif
@@ -57,7 +57,6 @@ const struct backend backend_vgem = {
 	.bo_create = vgem_bo_create,
 	.bo_destroy = drv_dumb_bo_destroy,
 	.bo_import = drv_prime_bo_import,
-	.bo_map = drv_dumb_bo_map,
-	.bo_unmap = drv_bo_munmap,
+	DRV_DMABUF_MAP_FUNCS,
 	.resolve_format = vgem_resolve_format,
 };
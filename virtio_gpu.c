@@ -6,10 +6,12 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <linux/dma-buf.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <unistd.h>
 #include <xf86drm.h>
 
 #include "drv_priv.h"
@@ -64,6 +66,8 @@ struct virtio_gpu_priv {
 	int caps_is_v2;
 	union virgl_caps caps;
 	int host_gbm_enabled;
+	/* Copy of features[].enabled, so that a cached init can restore it. */
+	uint32_t features_enabled[feat_max];
 };
 
 static uint32_t translate_format(uint32_t drm_fourcc)
@@ -565,6 +569,7 @@ static void virtio_gpu_init_features_and_caps(struct driver *drv)
 		int ret = drmIoctl(drv->fd, DRM_IOCTL_VIRTGPU_GETPARAM, &params);
 		if (ret)
 			drv_log("DRM_IOCTL_VIRTGPU_GET_PARAM failed with %s\n", strerror(errno));
+		priv->features_enabled[i] = features[i].enabled;
 	}
 
 	if (features[feat_3d].enabled) {
@@ -646,6 +651,14 @@ static int virtio_gpu_init(struct driver *drv)
 	return drv_modify_linear_combinations(drv);
 }
 
+static void virtio_gpu_init_cache_restore(struct driver *drv)
+{
+	struct virtio_gpu_priv *priv = (struct virtio_gpu_priv *)drv->priv;
+
+	for (uint32_t i = 0; i < ARRAY_SIZE(features); i++)
+		features[i].enabled = priv->features_enabled[i];
+}
+
 static void virtio_gpu_close(struct driver *drv)
 {
 	free(drv->priv);
@@ -677,12 +690,28 @@ static void *virtio_gpu_bo_map(struct bo *bo, struct vma *vma, size_t plane, uin
 		return drv_dumb_bo_map(bo, vma, plane, map_flags);
 }
 
+static int virtio_gpu_wait(struct bo *bo, struct mapping *mapping)
+{
+	int ret;
+	struct drm_virtgpu_3d_wait waitcmd;
+
+	memset(&waitcmd, 0, sizeof(waitcmd));
+	waitcmd.handle = mapping->vma->handle;
+
+	ret = drmIoctl(bo->drv->fd, DRM_IOCTL_VIRTGPU_WAIT, &waitcmd);
+	if (ret) {
+		drv_log("DRM_IOCTL_VIRTGPU_WAIT failed with %s\n", strerror(errno));
+		return -errno;
+	}
+
+	return 0;
+}
+
 static int virtio_gpu_bo_invalidate(struct bo *bo, struct mapping *mapping)
 {
 	int ret;
 	size_t i;
 	struct drm_virtgpu_3d_transfer_from_host xfer;
-	struct drm_virtgpu_3d_wait waitcmd;
 	struct virtio_transfers_params xfer_params;
 	struct virtio_gpu_priv *priv = (struct virtio_gpu_priv *)bo->drv->priv;
 
@@ -694,6 +723,11 @@ static int virtio_gpu_bo_invalidate(struct bo *bo, struct mapping *mapping)
 				   BO_USE_HW_VIDEO_ENCODER | BO_USE_HW_VIDEO_DECODER)) == 0)
 		return 0;
 
+	// The caller overwrites the whole rect, so there is nothing to read back; only wait
+	// for the host to be done with the buffer.
+	if (mapping->access_flags & BO_MAP_DISCARD)
+		return virtio_gpu_wait(bo, mapping);
+
 	memset(&xfer, 0, sizeof(xfer));
 	xfer.bo_handle = mapping->vma->handle;
 
@@ -739,32 +773,17 @@ static int virtio_gpu_bo_invalidate(struct bo *bo, struct mapping *mapping)
 	// The transfer needs to complete before invalidate returns so that any host changes
 	// are visible and to ensure the host doesn't overwrite subsequent guest changes.
 	// TODO(b/136733358): Support returning fences from transfers
-	memset(&waitcmd, 0, sizeof(waitcmd));
-	waitcmd.handle = mapping->vma->handle;
-	ret = drmIoctl(bo->drv->fd, DRM_IOCTL_VIRTGPU_WAIT, &waitcmd);
-	if (ret) {
-		drv_log("DRM_IOCTL_VIRTGPU_WAIT failed with %s\n", strerror(errno));
-		return -errno;
-	}
-
-	return 0;
+	return virtio_gpu_wait(bo, mapping);
 }
 
-static int virtio_gpu_bo_flush(struct bo *bo, struct mapping *mapping)
+static int virtio_gpu_transfer_to_host(struct bo *bo, struct mapping *mapping)
 {
 	int ret;
 	size_t i;
 	struct drm_virtgpu_3d_transfer_to_host xfer;
-	struct drm_virtgpu_3d_wait waitcmd;
 	struct virtio_transfers_params xfer_params;
 	struct virtio_gpu_priv *priv = (struct virtio_gpu_priv *)bo->drv->priv;
 
-	if (!features[feat_3d].enabled)
-		return 0;
-
-	if (!(mapping->vma->map_flags & BO_MAP_WRITE))
-		return 0;
-
 	memset(&xfer, 0, sizeof(xfer));
 	xfer.bo_handle = mapping->vma->handle;
 
@@ -801,22 +820,63 @@ static int virtio_gpu_bo_flush(struct bo *bo, struct mapping *mapping)
 		}
 	}
 
+	return 0;
+}
+
+static int virtio_gpu_bo_flush(struct bo *bo, struct mapping *mapping)
+{
+	int ret;
+
+	if (!features[feat_3d].enabled)
+		return 0;
+
+	if (!(mapping->vma->map_flags & BO_MAP_WRITE))
+		return 0;
+
+	ret = virtio_gpu_transfer_to_host(bo, mapping);
+	if (ret)
+		return ret;
+
 	// If the buffer is only accessed by the host GPU, then the flush is ordered
 	// with subsequent commands. However, if other host hardware can access the
 	// buffer, we need to wait for the transfer to complete for consistency.
-	// TODO(b/136733358): Support returning fences from transfers
-	if (bo->meta.use_flags & BO_USE_NON_GPU_HW) {
-		memset(&waitcmd, 0, sizeof(waitcmd));
-		waitcmd.handle = mapping->vma->handle;
+	if (bo->meta.use_flags & BO_USE_NON_GPU_HW)
+		return virtio_gpu_wait(bo, mapping);
 
-		ret = drmIoctl(bo->drv->fd, DRM_IOCTL_VIRTGPU_WAIT, &waitcmd);
-		if (ret) {
-			drv_log("DRM_IOCTL_VIRTGPU_WAIT failed with %s\n", strerror(errno));
-			return -errno;
-		}
+	return 0;
+}
+
+static int virtio_gpu_bo_flush_async(struct bo *bo, struct mapping *mapping, int *release_fence)
+{
+	int ret, dmabuf_fd;
+
+	*release_fence = -1;
+
+	if (!features[feat_3d].enabled)
+		return 0;
+
+	if (!(mapping->vma->map_flags & BO_MAP_WRITE))
+		return 0;
+
+	ret = virtio_gpu_transfer_to_host(bo, mapping);
+	if (ret)
+		return ret;
+
+	if (!(bo->meta.use_flags & BO_USE_NON_GPU_HW))
+		return 0;
+
+	// The transfer is fenced as a write on the buffer's reservation object, so readers can
+	// wait on that fence instead of the CPU blocking here.
+	dmabuf_fd = drv_bo_get_plane_fd(bo, 0);
+	if (dmabuf_fd >= 0) {
+		*release_fence = drv_dmabuf_export_sync_file(dmabuf_fd, DMA_BUF_SYNC_READ);
+		close(dmabuf_fd);
+		if (*release_fence >= 0)
+			return 0;
 	}
 
-	return 0;
+	*release_fence = -1;
+	return virtio_gpu_wait(bo, mapping);
 }
 
 static uint32_t virtio_gpu_resolve_format(struct driver *drv, uint32_t format, uint64_t use_flags)
@@ -884,6 +944,9 @@ const struct backend backend_virtio_gpu = {
 	.bo_unmap = drv_bo_munmap,
 	.bo_invalidate = virtio_gpu_bo_invalidate,
 	.bo_flush = virtio_gpu_bo_flush,
+	.bo_flush_async = virtio_gpu_bo_flush_async,
 	.resolve_format = virtio_gpu_resolve_format,
 	.resource_info = virtio_gpu_resource_info,
+	.init_cache_priv_size = sizeof(struct virtio_gpu_priv),
+	.init_cache_restore = virtio_gpu_init_cache_restore,
 };